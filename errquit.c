@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <allegro.h>
+#include "errquit.h"
+
+__thread errcatch_t *errcatch = NULL;
 
 void errquit(const char *msg, ...)
 {
@@ -12,6 +15,12 @@ void errquit(const char *msg, ...)
 	vsnprintf(str, sizeof str, msg, argptr);
 	va_end(argptr);
 
+	if (errcatch != NULL)
+	{
+		snprintf(errcatch->msg, sizeof errcatch->msg, "%s", str);
+		longjmp(errcatch->env, 1);
+	}
+
 	if (screen != NULL)
 		set_gfx_mode(GFX_TEXT, 0, 0, 0, 0);
 	allegro_message("%s", str);
@@ -1 +1,17 @@
+#include <setjmp.h>
+
+/*
+ * A thread that points errcatch at one of these gets errquit()'s
+ * message in msg and a longjmp() back to env, instead of the program
+ * quitting. Used by the tile server, so a bad file only fails its
+ * request.
+ */
+typedef struct
+{
+	jmp_buf env;
+	char msg[1100];
+} errcatch_t;
+
+extern __thread errcatch_t *errcatch;
+
 void errquit(const char *msg, ...);
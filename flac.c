@@ -0,0 +1,861 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xm.h"
+#include "errquit.h"
+#include "pool.h"
+#include "track.h"
+#include "flac.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#undef MAX
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/*
+ * A FLAC decoder, just enough for viewwav: stereo streams of up to 24
+ * bits, which are cut down to 16 like 24-bit wav files are.
+ *
+ * Decoding is done in parallel. The compressed stream is split into
+ * parts by byte offset, and each part first looks for the first frame
+ * that starts in it: at a seek point if the file has a seek table,
+ * otherwise by scanning for a frame sync code. A candidate only counts
+ * if its header and whole-frame CRCs check out. Then every part
+ * decodes its frames, up to where the next part's first frame is, and
+ * each frame's header says where its samples go in the track.
+ */
+
+#define PART_MIN_BYTES (256 * 1024)
+#define NO_FRAME SIZE_MAX
+
+/* What the STREAMINFO and SEEKTABLE blocks say about a stream. */
+typedef struct
+{
+	int minblocksize, maxblocksize;
+	int samprate;
+	int channels;
+	int bitspersample;
+	uint64_t totalsamples; // 0 if unknown.
+	uint64_t *seekoffsets; // Seek points, from the first frame.
+	int nseekpoints;
+} flacinfo_t;
+
+static uint8_t crc8table[256];
+static uint16_t crc16table[256];
+static pthread_once_t crconce = PTHREAD_ONCE_INIT;
+
+static void makecrctables(void)
+{
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		unsigned c8 = i, c16 = i << 8;
+
+		for (j = 0; j < 8; j++)
+		{
+			c8 = c8 & 0x80 ? c8 << 1 ^ 0x07 : c8 << 1;
+			c16 = c16 & 0x8000 ? c16 << 1 ^ 0x8005 : c16 << 1;
+		}
+		crc8table[i] = (uint8_t)c8;
+		crc16table[i] = (uint16_t)c16;
+	}
+}
+
+static unsigned crc8(const unsigned char *p, size_t n)
+{
+	unsigned crc = 0;
+
+	while (n-- > 0)
+		crc = crc8table[crc ^ *p++];
+	return crc;
+}
+
+static unsigned crc16(const unsigned char *p, size_t n)
+{
+	unsigned crc = 0;
+
+	while (n-- > 0)
+		crc = (crc << 8 & 0xFFFF) ^ crc16table[crc >> 8 ^ *p++];
+	return crc;
+}
+
+/*
+ * Reads a frame a few bits at a time. The cache holds the next bits,
+ * starting from its top bit. Reading past the end gives zeros, which
+ * the caller catches afterwards by checking bitsused().
+ */
+typedef struct
+{
+	const unsigned char *buf;
+	size_t len;
+	size_t pos; // Next byte to go into the cache.
+	uint64_t cache;
+	int nbits; // How many bits of the cache are real.
+} bits_t;
+
+static void refill(bits_t *b)
+{
+	while (b->nbits <= 56)
+	{
+		const uint64_t byte = b->pos < b->len ? b->buf[b->pos] : 0;
+
+		b->cache |= byte << (56 - b->nbits);
+		b->pos++;
+		b->nbits += 8;
+	}
+}
+
+static uint64_t bitsused(const bits_t *b)
+{
+	return (uint64_t)b->pos * 8 - b->nbits;
+}
+
+// Read n bits, 0 to 32, as an unsigned number.
+static uint32_t getbits(bits_t *b, int n)
+{
+	uint32_t v;
+
+	if (n == 0)
+		return 0;
+	if (b->nbits < n)
+		refill(b);
+	v = (uint32_t)(b->cache >> (64 - n));
+	b->cache <<= n;
+	b->nbits -= n;
+	return v;
+}
+
+// Read n bits, 1 to 32, as a two's complement number.
+static int32_t getsigned(bits_t *b, int n)
+{
+	const uint32_t v = getbits(b, n);
+
+	if (n < 32 && v >> (n - 1))
+		return (int32_t)(v | ~0u << n);
+	return (int32_t)v;
+}
+
+// Count zero bits up to the next one bit, and skip the one.
+static uint32_t getunary(bits_t *b)
+{
+	uint32_t n = 0;
+
+	for (;;)
+	{
+		int z;
+
+		refill(b);
+		if (b->cache == 0)
+		{
+			n += b->nbits;
+			b->cache = 0;
+			b->nbits = 0;
+			if (b->pos > b->len + 8)
+				return n; // Ran off the end; caught later.
+			continue;
+		}
+		z = __builtin_clzll(b->cache);
+		n += z;
+		b->cache = z == 63 ? 0 : b->cache << (z + 1);
+		b->nbits -= z + 1;
+		return n;
+	}
+}
+
+static void bytealign(bits_t *b)
+{
+	getbits(b, b->nbits % 8);
+}
+
+/*
+ * Read the frame header's coded frame or sample number: like UTF-8,
+ * but up to 36 bits. Returns false if it's malformed.
+ */
+static bool getcodednumber(bits_t *b, uint64_t *pv)
+{
+	const uint32_t first = getbits(b, 8);
+	uint64_t v;
+	int more, i;
+
+	if (!(first & 0x80))
+		more = 0, v = first;
+	else if ((first & 0xE0) == 0xC0)
+		more = 1, v = first & 0x1F;
+	else if ((first & 0xF0) == 0xE0)
+		more = 2, v = first & 0x0F;
+	else if ((first & 0xF8) == 0xF0)
+		more = 3, v = first & 0x07;
+	else if ((first & 0xFC) == 0xF8)
+		more = 4, v = first & 0x03;
+	else if ((first & 0xFE) == 0xFC)
+		more = 5, v = first & 0x01;
+	else if (first == 0xFE)
+		more = 6, v = 0;
+	else
+		return false;
+
+	for (i = 0; i < more; i++)
+	{
+		const uint32_t c = getbits(b, 8);
+
+		if ((c & 0xC0) != 0x80)
+			return false;
+		v = v << 6 | (c & 0x3F);
+	}
+	*pv = v;
+	return true;
+}
+
+// Read a partitioned Rice coded residual into out[order..blocksize-1].
+static bool getresidual(bits_t *b, int32_t *out, int blocksize, int order)
+{
+	const uint32_t method = getbits(b, 2);
+	const int parambits = method == 0 ? 4 : 5;
+	const uint32_t escape = (1u << parambits) - 1;
+	const int partorder = (int)getbits(b, 4);
+	const int partsize = blocksize >> partorder;
+	int part, i = order;
+
+	if (method > 1 || partsize << partorder != blocksize
+		|| partsize < order)
+	{
+		return false;
+	}
+
+	for (part = 0; part < 1 << partorder; part++)
+	{
+		const int end = (part + 1) * partsize;
+		const uint32_t k = getbits(b, parambits);
+
+		if (k == escape)
+		{
+			// Not Rice coded: each value has the same number of bits.
+			const int rawbits = (int)getbits(b, 5);
+
+			for (; i < end; i++)
+				out[i] = rawbits == 0 ? 0 : getsigned(b, rawbits);
+			continue;
+		}
+
+		for (; i < end; i++)
+		{
+			const uint32_t q = getunary(b);
+			const uint32_t v = q << k | getbits(b, (int)k);
+
+			out[i] = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+		}
+	}
+	return true;
+}
+
+/*
+ * Decode one subframe of bps bits per sample into out. Residuals are
+ * read into out and then turned into samples in place.
+ */
+static bool getsubframe(bits_t *b, int32_t *out, int blocksize, int bps)
+{
+	const int32_t *const r = out;
+	int type, wasted = 0, order, i, j;
+
+	if (getbits(b, 1) != 0)
+		return false;
+	type = (int)getbits(b, 6);
+	if (getbits(b, 1))
+	{
+		wasted = (int)getunary(b) + 1;
+		if (wasted >= bps)
+			return false;
+		bps -= wasted;
+	}
+
+	if (type == 0) // CONSTANT
+	{
+		const int32_t v = getsigned(b, bps);
+
+		for (i = 0; i < blocksize; i++)
+			out[i] = v;
+	}
+	else if (type == 1) // VERBATIM
+	{
+		for (i = 0; i < blocksize; i++)
+			out[i] = getsigned(b, bps);
+	}
+	else if (type >= 8 && type <= 12) // FIXED
+	{
+		order = type - 8;
+		if (order > blocksize)
+			return false;
+		for (i = 0; i < order; i++)
+			out[i] = getsigned(b, bps);
+		if (!getresidual(b, out, blocksize, order))
+			return false;
+
+		switch (order)
+		{
+		case 1:
+			for (i = 1; i < blocksize; i++)
+				out[i] = r[i] + out[i-1];
+			break;
+		case 2:
+			for (i = 2; i < blocksize; i++)
+				out[i] = r[i] + 2*out[i-1] - out[i-2];
+			break;
+		case 3:
+			for (i = 3; i < blocksize; i++)
+				out[i] = r[i] + 3*out[i-1] - 3*out[i-2]
+					+ out[i-3];
+			break;
+		case 4:
+			for (i = 4; i < blocksize; i++)
+				out[i] = r[i] + 4*out[i-1] - 6*out[i-2]
+					+ 4*out[i-3] - out[i-4];
+			break;
+		}
+	}
+	else if (type >= 32) // LPC
+	{
+		int32_t coefs[32];
+		int precision, shift;
+
+		order = type - 31;
+		if (order > blocksize)
+			return false;
+		for (i = 0; i < order; i++)
+			out[i] = getsigned(b, bps);
+		precision = (int)getbits(b, 4) + 1;
+		shift = getsigned(b, 5);
+		if (precision == 16 || shift < 0)
+			return false;
+		for (i = 0; i < order; i++)
+			coefs[i] = getsigned(b, precision);
+		if (!getresidual(b, out, blocksize, order))
+			return false;
+
+		for (i = order; i < blocksize; i++)
+		{
+			int64_t sum = 0;
+
+			for (j = 0; j < order; j++)
+				sum += (int64_t)coefs[j] * out[i-1-j];
+			out[i] = r[i] + (int32_t)(sum >> shift);
+		}
+	}
+	else
+		return false;
+
+	if (wasted > 0)
+		for (i = 0; i < blocksize; i++)
+			out[i] = (int32_t)((uint32_t)out[i] << wasted);
+	return true;
+}
+
+/* Where a decoded frame goes and how to turn it into 16-bit samples. */
+typedef struct
+{
+	uint64_t firstsample;
+	int blocksize;
+	int bps;
+	size_t len; // In bytes, counting the CRC at its end.
+} frame_t;
+
+/*
+ * Decode the frame at the start of buf (len bytes from there to the end
+ * of the stream) into ch[0] and ch[1], which have room for the stream's
+ * biggest block. Returns false unless there is a frame there and both
+ * of its CRCs are right.
+ */
+static bool decodeframe(const flacinfo_t *info, const unsigned char *buf,
+	size_t len, int32_t *ch[2], frame_t *f)
+{
+	static const int bpscodes[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+	bits_t b = { buf, len, 0, 0, 0 };
+	uint32_t bscode, ratecode, chanmode, bpscode;
+	uint64_t number;
+	int blocksize, bps, i;
+	size_t headlen;
+
+	if (len < 6 || buf[0] != 0xFF || (buf[1] & 0xFE) != 0xF8)
+		return false;
+	getbits(&b, 16);
+	bscode = getbits(&b, 4);
+	ratecode = getbits(&b, 4);
+	chanmode = getbits(&b, 4);
+	bpscode = getbits(&b, 3);
+	if (getbits(&b, 1) != 0 || bscode == 0 || ratecode == 15
+		|| bpscode == 3 || bpscode == 7 || chanmode > 10
+		|| (chanmode < 8 && chanmode != 1))
+	{
+		return false;
+	}
+	if (!getcodednumber(&b, &number))
+		return false;
+
+	if (bscode == 1)
+		blocksize = 192;
+	else if (bscode <= 5)
+		blocksize = 576 << (bscode - 2);
+	else if (bscode == 6)
+		blocksize = (int)getbits(&b, 8) + 1;
+	else if (bscode == 7)
+		blocksize = (int)getbits(&b, 16) + 1;
+	else
+		blocksize = 256 << (bscode - 8);
+	if (ratecode == 12)
+		getbits(&b, 8);
+	else if (ratecode >= 13)
+		getbits(&b, 16);
+
+	headlen = (size_t)(bitsused(&b) / 8);
+	if (headlen >= len || crc8(buf, headlen) != getbits(&b, 8))
+		return false;
+	if (blocksize > info->maxblocksize)
+		return false;
+
+	bps = bpscode == 0 ? info->bitspersample : bpscodes[bpscode];
+	if (bps != info->bitspersample)
+		return false;
+
+	// The side channel needs an extra bit.
+	if (!getsubframe(&b, ch[0], blocksize, bps + (chanmode == 9))
+		|| !getsubframe(&b, ch[1], blocksize,
+		bps + (chanmode == 8 || chanmode == 10)))
+	{
+		return false;
+	}
+	bytealign(&b);
+	if (bitsused(&b) + 16 > (uint64_t)len * 8)
+		return false;
+	f->len = (size_t)(bitsused(&b) / 8) + 2;
+	if (crc16(buf, f->len - 2) != getbits(&b, 16))
+		return false;
+
+	for (i = 0; i < blocksize; i++)
+	{
+		const int32_t a = ch[0][i], s = ch[1][i];
+
+		switch (chanmode)
+		{
+		case 8: // Left, side.
+			ch[1][i] = a - s;
+			break;
+		case 9: // Side, right.
+			ch[0][i] = a + s;
+			break;
+		case 10: // Mid, side.
+		{
+			const int32_t mid = (int32_t)((uint32_t)a << 1) | (s & 1);
+
+			ch[0][i] = (mid + s) >> 1;
+			ch[1][i] = (mid - s) >> 1;
+			break;
+		}
+		}
+	}
+
+	// With a fixed block size, frames are numbered rather than samples.
+	f->firstsample = buf[1] & 1 ? number
+		: number * (uint64_t)info->maxblocksize;
+	f->blocksize = blocksize;
+	f->bps = bps;
+	return true;
+}
+
+/* The stream, split into parts for pool_for(). */
+typedef struct
+{
+	const flacinfo_t *info;
+	const unsigned char *frames; // From the first frame to end of file.
+	size_t len;
+	int16_t *samples; // Interleaved, totalsamples frames of them.
+	int nparts;
+	size_t *first; // Where each part's first frame is, or NO_FRAME.
+	size_t *stop; // Where the next part's first frame is.
+	uint64_t decoded; // Samples decoded so far, by all parts.
+	bool failed; // Did a part find a bad frame?
+} flacjob_t;
+
+static int32_t **newscratch(const flacinfo_t *info)
+{
+	int32_t **const ch = xm(sizeof *ch, 2);
+
+	ch[0] = xm(sizeof **ch, (size_t)info->maxblocksize * 2);
+	ch[1] = ch[0] + info->maxblocksize;
+	return ch;
+}
+
+static void freescratch(int32_t **ch)
+{
+	free(ch[0]);
+	free(ch);
+}
+
+static size_t partstart(const flacjob_t *job, int part)
+{
+	return (size_t)((uint64_t)job->len * part / job->nparts);
+}
+
+// Find the first frame of a part, for pool_for().
+static void findfirst(void *arg, int part)
+{
+	flacjob_t *const job = arg;
+	const flacinfo_t *const info = job->info;
+	const size_t start = partstart(job, part);
+	const size_t end = partstart(job, part + 1);
+	int32_t **const ch = newscratch(info);
+	frame_t f;
+	size_t at;
+	int i;
+
+	job->first[part] = NO_FRAME;
+
+	// A seek point in the part saves looking.
+	for (i = 0; i < info->nseekpoints; i++)
+	{
+		const uint64_t off = info->seekoffsets[i];
+
+		if (off >= start && off < end && decodeframe(info,
+			&job->frames[off], job->len - off, ch, &f))
+		{
+			job->first[part] = (size_t)off;
+			break;
+		}
+	}
+
+	for (at = start; job->first[part] == NO_FRAME && at < end; at++)
+	{
+		const unsigned char *const p = memchr(&job->frames[at], 0xFF,
+			end - at);
+
+		if (p == NULL)
+			break;
+		at = (size_t)(p - job->frames);
+		if (decodeframe(info, p, job->len - at, ch, &f))
+			job->first[part] = at;
+	}
+	freescratch(ch);
+}
+
+// Decode the frames of a part into the track, for pool_for().
+static void decodepart(void *arg, int part)
+{
+	flacjob_t *const job = arg;
+	const flacinfo_t *const info = job->info;
+	const int shift = info->bitspersample - 16;
+	const size_t stop = job->stop[part];
+	int32_t **ch;
+	uint64_t decoded = 0;
+	size_t at = job->first[part];
+	frame_t f;
+
+	if (at == NO_FRAME)
+		return;
+	ch = newscratch(info);
+
+	while (at < stop)
+	{
+		int16_t *dst;
+		int i;
+
+		if (!decodeframe(info, &job->frames[at], job->len - at, ch, &f))
+		{
+			// Whatever is after the last frame (tags, say) is fine.
+			if (stop != job->len)
+				__atomic_store_n(&job->failed, true,
+					__ATOMIC_RELAXED);
+			break;
+		}
+		if (f.firstsample + f.blocksize > info->totalsamples)
+		{
+			__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+			break;
+		}
+
+		dst = &job->samples[f.firstsample * 2];
+		for (i = 0; i < f.blocksize; i++)
+		{
+			if (shift >= 0)
+			{
+				dst[i*2] = (int16_t)(ch[0][i] >> shift);
+				dst[i*2+1] = (int16_t)(ch[1][i] >> shift);
+			}
+			else
+			{
+				dst[i*2] = (int16_t)(ch[0][i] << -shift);
+				dst[i*2+1] = (int16_t)(ch[1][i] << -shift);
+			}
+		}
+		decoded += f.blocksize;
+		at += f.len;
+	}
+	if (at > stop) // The next part's first frame wasn't one.
+		__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&job->decoded, decoded, __ATOMIC_RELAXED);
+	freescratch(ch);
+}
+
+/*
+ * If the stream doesn't say how long it is, it ends where its last
+ * frame does. Look for that frame backward from the end of the file.
+ */
+static uint64_t findlength(const flacinfo_t *info,
+	const unsigned char *frames, size_t len)
+{
+	int32_t **const ch = newscratch(info);
+	uint64_t total = 0;
+	frame_t f;
+	size_t at;
+
+	for (at = len; at-- > 0; )
+	{
+		if (frames[at] == 0xFF
+			&& decodeframe(info, &frames[at], len - at, ch, &f))
+		{
+			total = f.firstsample + f.blocksize;
+			break;
+		}
+	}
+	freescratch(ch);
+	return total;
+}
+
+/*
+ * Read the metadata blocks at the start of buf, after the "fLaC", into
+ * info, and set *pframes to the offset of the first frame. Returns why
+ * the stream can't be read, or NULL if it can.
+ */
+static const char *readmetadata(const unsigned char *buf, size_t len,
+	flacinfo_t *info, size_t *pframes)
+{
+	size_t at = 4;
+	bool last = false, gotinfo = false;
+
+	while (!last)
+	{
+		const unsigned char *const p = &buf[at + 4];
+		size_t blocklen;
+		int type;
+
+		if (len - at < 4)
+			return "invalid FLAC file";
+		last = buf[at] & 0x80;
+		type = buf[at] & 0x7F;
+		blocklen = (size_t)buf[at+1] << 16 | buf[at+2] << 8 | buf[at+3];
+		if (len - at - 4 < blocklen)
+			return "invalid FLAC file";
+
+		if (type == 0 && blocklen >= 34) // STREAMINFO
+		{
+			info->minblocksize = p[0] << 8 | p[1];
+			info->maxblocksize = p[2] << 8 | p[3];
+			info->samprate = p[10] << 12 | p[11] << 4 | p[12] >> 4;
+			info->channels = (p[12] >> 1 & 7) + 1;
+			info->bitspersample = ((p[12] & 1) << 4 | p[13] >> 4) + 1;
+			info->totalsamples = (uint64_t)(p[13] & 0xF) << 32
+				| (uint64_t)p[14] << 24 | p[15] << 16
+				| p[16] << 8 | p[17];
+			gotinfo = true;
+		}
+		else if (type == 3 && info->seekoffsets == NULL) // SEEKTABLE
+		{
+			const int n = (int)(blocklen / 18);
+			int i;
+
+			info->seekoffsets = xm(sizeof *info->seekoffsets,
+				MAX(n, 1));
+			for (i = 0; i < n; i++)
+			{
+				const unsigned char *const s = &p[i * 18];
+				uint64_t sample = 0, off = 0;
+				int j;
+
+				for (j = 0; j < 8; j++)
+				{
+					sample = sample << 8 | s[j];
+					off = off << 8 | s[8 + j];
+				}
+				if (sample != UINT64_MAX) // Not a placeholder.
+					info->seekoffsets[info->nseekpoints++] = off;
+			}
+		}
+		at += 4 + blocklen;
+	}
+
+	*pframes = at;
+	if (!gotinfo || info->maxblocksize < 16)
+		return "invalid FLAC file";
+	if (info->channels != 2)
+		return "non-stereo FLAC files not supported";
+	if (info->bitspersample < 8 || info->bitspersample > 24)
+		return "unsupported FLAC bit depth";
+	if (info->samprate == 0 || info->samprate > 384000)
+		return "unsupported sample rate";
+	return NULL;
+}
+
+/* Where loadflac() got the bytes of the file. */
+typedef struct
+{
+	unsigned char *buf;
+	size_t len;
+	bool mapped;
+	size_t charged;
+} flacfile_t;
+
+/*
+ * Get the whole file into memory: map a regular file, or else read it
+ * all, starting with the head bytes that were already read off fp.
+ */
+static void readfile(const char *name, FILE *fp, const unsigned char *head,
+	size_t headlen, flacfile_t *file)
+{
+	struct stat st;
+	size_t capacity;
+
+	file->mapped = false;
+	file->charged = 0;
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+		&& st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX)
+	{
+		file->len = (size_t)st.st_size;
+		file->buf = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE,
+			fileno(fp), 0);
+		if (file->buf != MAP_FAILED)
+		{
+			file->mapped = true;
+			return;
+		}
+	}
+
+	capacity = MAX(headlen, 1 << 20);
+	track_charge(capacity, name);
+	file->charged = capacity;
+	file->buf = xm(1, capacity);
+	memcpy(file->buf, head, headlen);
+	file->len = headlen;
+	for (;;)
+	{
+		file->len += fread(file->buf + file->len, 1,
+			capacity - file->len, fp);
+		if (file->len < capacity)
+			break;
+		track_charge(capacity, name);
+		file->charged += capacity;
+		capacity *= 2;
+		file->buf = xr(file->buf, 1, capacity);
+	}
+}
+
+static void freefile(flacfile_t *file)
+{
+	if (file->mapped)
+		munmap(file->buf, file->len);
+	else
+		free(file->buf);
+	track_uncharge(file->charged);
+}
+
+bool isflachead(const unsigned char *head, size_t headlen)
+{
+	return headlen >= 4 && memcmp(head, "fLaC", 4) == 0;
+}
+
+/*
+ * Load a FLAC file (already opened) and make a track out of it. head is
+ * the first bytes of the file, already read.
+ */
+track_t *loadflac(const char *name, FILE *fp, const unsigned char *head,
+	size_t headlen)
+{
+	flacfile_t file;
+	flacinfo_t info;
+	flacjob_t job;
+	const char *why = NULL;
+	size_t start, frames, samplebytes;
+	int i, next;
+	track_t *t;
+
+	memset(&info, 0, sizeof info);
+	readfile(name, fp, head, headlen, &file);
+	pthread_once(&crconce, makecrctables);
+
+	// Skip an ID3v2 tag, which some taggers put in front.
+	start = 0;
+	if (file.len >= 10 && memcmp(file.buf, "ID3", 3) == 0)
+	{
+		start = 10 + ((size_t)(file.buf[6] & 0x7F) << 21
+			| (file.buf[7] & 0x7F) << 14
+			| (file.buf[8] & 0x7F) << 7 | (file.buf[9] & 0x7F));
+		if (file.buf[5] & 0x10)
+			start += 10; // Footer.
+	}
+	if (start > file.len || !isflachead(&file.buf[start], file.len - start))
+		why = "invalid FLAC file";
+	else
+		why = readmetadata(&file.buf[start], file.len - start, &info,
+			&frames);
+
+	if (why == NULL)
+	{
+		job.info = &info;
+		job.frames = &file.buf[start + frames];
+		job.len = file.len - start - frames;
+		if (info.totalsamples == 0)
+			info.totalsamples = findlength(&info, job.frames,
+				job.len);
+		if (info.totalsamples == 0)
+			why = "no audio";
+		else if (info.totalsamples > INT32_MAX - SAMPLES_PER_BLOCK)
+			why = "too long";
+	}
+	if (why != NULL)
+	{
+		free(info.seekoffsets);
+		freefile(&file);
+		errquit("%s: %s", name, why);
+	}
+
+	samplebytes = (size_t)info.totalsamples * 2 * sizeof *job.samples;
+	track_charge(samplebytes, name);
+	job.samples = xm(2 * sizeof *job.samples, (size_t)info.totalsamples);
+	job.nparts = (int)MAX(1, MIN(job.len / PART_MIN_BYTES,
+		(size_t)pool_numcpus() * 4));
+	job.first = xm(sizeof *job.first, job.nparts);
+	job.stop = xm(sizeof *job.stop, job.nparts);
+	job.decoded = 0;
+	job.failed = false;
+
+	pool_for(findfirst, &job, job.nparts);
+	for (i = 0, next = 0; i < job.nparts; i++)
+	{
+		if (next <= i)
+			for (next = i + 1; next < job.nparts
+				&& job.first[next] == NO_FRAME; next++)
+				;
+		job.stop[i] = next < job.nparts ? job.first[next] : job.len;
+	}
+	pool_for(decodepart, &job, job.nparts);
+
+	free(job.first);
+	free(job.stop);
+	free(info.seekoffsets);
+	freefile(&file);
+	if (job.failed || job.decoded != info.totalsamples)
+	{
+		free(job.samples);
+		track_uncharge(samplebytes);
+		errquit("%s: corrupt FLAC data", name);
+	}
+
+	t = track_new(name, job.samples, (int)info.totalsamples,
+		info.samprate, NULL);
+	t->membytes += samplebytes;
+	track_fillall(t);
+	return t;
+}
@@ -0,0 +1,6 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+bool isflachead(const unsigned char *head, size_t headlen);
+track_t *loadflac(const char *name, FILE *fp, const unsigned char *head,
+	size_t headlen);
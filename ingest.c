@@ -0,0 +1,306 @@
+#include <endian.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xm.h"
+#include "errquit.h"
+#include "pool.h"
+#include "track.h"
+#include "ingest.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#undef MAX
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/*
+ * Loading happens in one pass. The file is read a batch at a time, and
+ * each batch is split into chunks which the worker pool converts to
+ * 16-bit native-endian samples and summarizes, block by block, while
+ * the block is still in cache. 16-bit data is read straight into the
+ * sample storage and converted in place; other sizes go through a
+ * bounce buffer. When ingest() returns, every summary is filled in.
+ */
+
+#define CHUNK_BLOCKS 256
+#define CHUNK_FRAMES (CHUNK_BLOCKS * SAMPLES_PER_BLOCK)
+#define INITIAL_FRAMES (16 * CHUNK_FRAMES) // When the length is unknown.
+
+typedef struct
+{
+	const ingestfmt_t *fmt;
+	int16_t *samples; // Interleaved, for the whole track.
+	level_t *blocks; // For the whole track.
+	// Raw bytes of the batch, or NULL if the samples need no converting.
+	const unsigned char *src;
+	int firstframe; // Where the batch starts in the track.
+	int numframes; // Frames in the batch.
+} batch_t;
+
+// Convert n samples (not frames) of the given size to native 16-bit.
+static void decode(int16_t *dst, const unsigned char *src, int n, int size)
+{
+	int i;
+
+	if (size == 2)
+	{
+		// In place: src and dst are the same memory.
+		for (i = 0; i < n; i++)
+			dst[i] = le16toh(dst[i]);
+		return;
+	}
+
+	// Keep the top 16 bits of each sample.
+	for (i = 0; i < n; i++)
+	{
+		const unsigned char *const p = &src[i*size + size - 2];
+		dst[i] = (int16_t)(p[0] | p[1] << 8);
+	}
+}
+
+// Convert and summarize chunk i of a batch, for pool_for().
+static void ingestchunk(void *arg, int i)
+{
+	const batch_t *const b = arg;
+	const int size = b->fmt->bytespersample;
+	const int last = MIN((i+1) * CHUNK_FRAMES, b->numframes);
+	int first;
+
+	for (first = i * CHUNK_FRAMES; first < last;
+		first += SAMPLES_PER_BLOCK)
+	{
+		const int frame = b->firstframe + first;
+		const int n = MIN(SAMPLES_PER_BLOCK, last - first);
+		int16_t *const dst = &b->samples[(size_t)frame * 2];
+
+		if (b->src != NULL)
+			decode(dst, &b->src[first * 2 * size], n * 2, size);
+		track_summarize(b->blocks, frame / SAMPLES_PER_BLOCK, dst, n);
+	}
+}
+
+/* Where ingest() gets its bytes: the prefix first, then the file. */
+typedef struct
+{
+	FILE *fp;
+	const unsigned char *prefix;
+	size_t prefixlen;
+} source_t;
+
+static size_t readsource(source_t *src, unsigned char *dst, size_t n)
+{
+	const size_t fromprefix = MIN(n, src->prefixlen);
+
+	memcpy(dst, src->prefix, fromprefix);
+	src->prefix += fromprefix;
+	src->prefixlen -= fromprefix;
+	return fromprefix + fread(dst + fromprefix, 1, n - fromprefix, src->fp);
+}
+
+/*
+ * Free what ingest() has made so far and give back what it charged,
+ * before an error that may be caught (as the tile server does).
+ */
+static void dropingest(unsigned char *bounce, int16_t *samples,
+	level_t *blocks, size_t charged)
+{
+	free(bounce);
+	free(samples);
+	track_freelevel(blocks);
+	track_uncharge(charged);
+}
+
+/*
+ * Read sample data from fp and make a track of it. prefix holds bytes
+ * of the data that were already read off fp (to sniff the format, say).
+ * datalen is the number of bytes of data, counting the prefix, or -1 to
+ * read until end of file.
+ */
+track_t *ingest(const char *name, FILE *fp, const ingestfmt_t *fmt,
+	const unsigned char *prefix, size_t prefixlen, int64_t datalen)
+{
+	const int framesize = 2 * fmt->bytespersample;
+	const int batchframes = (pool_numcpus() + 1) * CHUNK_FRAMES;
+	source_t src = { fp, prefix, prefixlen };
+	unsigned char *bounce = NULL;
+	int16_t *samples = NULL;
+	level_t blocks;
+	int numframes = 0, capacity = 0;
+	size_t charged = 0;
+	track_t *t;
+
+	if (datalen >= 0 && datalen / framesize > INT32_MAX - SAMPLES_PER_BLOCK)
+		errquit("%s is too long", name);
+	if (fmt->bytespersample != 2)
+		bounce = xm(framesize, batchframes);
+	memset(&blocks, 0, sizeof blocks);
+
+	for (;;)
+	{
+		int want = batchframes;
+		int got;
+		size_t bytes;
+		unsigned char *dst;
+		batch_t batch;
+
+		if (datalen >= 0)
+			want = (int)MIN(want, datalen / framesize - numframes);
+		if (want <= 0)
+			break;
+
+		// Make room for the batch, in whole blocks.
+		if (numframes + want > capacity)
+		{
+			const int oldcapacity = capacity;
+			size_t samplebytes, blockbytes;
+
+			if (datalen >= 0)
+				capacity = (int)(datalen / framesize);
+			else
+			{
+				if (capacity == 0)
+					capacity = INITIAL_FRAMES;
+				while (numframes + want > capacity)
+				{
+					if (capacity > INT32_MAX / 2)
+					{
+						dropingest(bounce, samples,
+							&blocks, charged);
+						errquit("%s is too long", name);
+					}
+					capacity *= 2;
+				}
+			}
+			capacity += SAMPLES_PER_BLOCK - 1;
+			capacity -= capacity % SAMPLES_PER_BLOCK;
+
+			samplebytes = (size_t)(capacity - oldcapacity)
+				* 2 * sizeof *samples;
+			blockbytes =
+				track_levelbytes(0, capacity / SAMPLES_PER_BLOCK)
+				- track_levelbytes(0, oldcapacity
+				/ SAMPLES_PER_BLOCK);
+			track_charge(samplebytes, name);
+			track_charge(blockbytes, name);
+			charged += samplebytes + blockbytes;
+			samples = xr(samples, 2 * sizeof *samples, capacity);
+			track_growlevel(&blocks, 0,
+				capacity / SAMPLES_PER_BLOCK);
+		}
+
+		dst = bounce != NULL ? bounce
+			: (unsigned char *)&samples[(size_t)numframes * 2];
+		bytes = readsource(&src, dst, (size_t)want * framesize);
+		got = (int)(bytes / framesize);
+
+		batch.fmt = fmt;
+		batch.samples = samples;
+		batch.blocks = &blocks;
+		batch.src = dst;
+		batch.firstframe = numframes;
+		batch.numframes = got;
+		pool_for(ingestchunk, &batch,
+			(got + CHUNK_FRAMES - 1) / CHUNK_FRAMES);
+		numframes += got;
+
+		if (got < want)
+		{
+			if (datalen >= 0)
+			{
+				dropingest(bounce, samples, &blocks, charged);
+				errquit("%s: data chunk wrong size", name);
+			}
+			break;
+		}
+	}
+
+	free(bounce);
+
+	// Give back room left over, so a track's samples take exactly
+	// numframes frames, as track_pack() expects.
+	if (capacity > numframes)
+	{
+		const size_t spare = (size_t)(capacity - numframes)
+			* 2 * sizeof *samples;
+
+		samples = xr(samples, 2 * sizeof *samples, MAX(numframes, 1));
+		track_uncharge(spare);
+		charged -= spare;
+	}
+
+	t = track_new(name, samples, numframes, fmt->samprate, &blocks);
+	t->membytes += charged;
+	track_fillall(t);
+	return t;
+}
+
+/*
+ * Make a track of the data at offset in a regular file by mapping it
+ * into memory and using it where it lies, so nothing is copied and
+ * only the summaries are charged against the memory budget. datalen
+ * is the number of bytes of data. This only works for 16-bit data on a
+ * little-endian machine; otherwise, or if the mapping fails, it
+ * returns NULL for the caller to ingest() the data instead.
+ */
+track_t *ingest_mapped(const char *name, FILE *fp, const ingestfmt_t *fmt,
+	int64_t offset, int64_t datalen)
+{
+	const uint16_t one = 1;
+	const long pagesize = sysconf(_SC_PAGESIZE);
+	const int64_t mapstart = pagesize > 0 ? offset - offset % pagesize : 0;
+	struct stat st;
+	int numframes;
+	size_t maplen, blockbytes;
+	void *map;
+	level_t blocks;
+	batch_t batch;
+	track_t *t;
+
+	if (fmt->bytespersample != 2 || *(const unsigned char *)&one != 1
+		|| offset % 2 != 0 || pagesize <= 0
+		|| fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		return NULL;
+	}
+	if (offset + datalen > st.st_size)
+		errquit("%s: data chunk wrong size", name);
+	if (datalen / 4 > INT32_MAX - SAMPLES_PER_BLOCK)
+		errquit("%s is too long", name);
+	numframes = (int)(datalen / 4);
+	if (numframes == 0)
+		return NULL;
+
+	maplen = (size_t)(offset - mapstart) + (size_t)numframes * 4;
+	map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fileno(fp),
+		(off_t)mapstart);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	blockbytes = track_levelbytes(0, (numframes + SAMPLES_PER_BLOCK - 1)
+		/ SAMPLES_PER_BLOCK);
+	track_charge(blockbytes, name);
+	memset(&blocks, 0, sizeof blocks);
+	track_growlevel(&blocks, 0,
+		(numframes + SAMPLES_PER_BLOCK - 1) / SAMPLES_PER_BLOCK);
+
+	batch.fmt = fmt;
+	batch.samples = (int16_t *)((char *)map + (offset - mapstart));
+	batch.blocks = &blocks;
+	batch.src = NULL;
+	batch.firstframe = 0;
+	batch.numframes = numframes;
+	pool_for(ingestchunk, &batch,
+		(numframes + CHUNK_FRAMES - 1) / CHUNK_FRAMES);
+
+	t = track_new(name, batch.samples, numframes, fmt->samprate, &blocks);
+	t->mapping = map;
+	t->maplen = maplen;
+	t->membytes += blockbytes;
+	track_fillall(t);
+	return t;
+}
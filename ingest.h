@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stdio.h>
+
+/* How the sample data of a file is stored: signed, little-endian, stereo. */
+typedef struct
+{
+	int bytespersample; // 2 or 3.
+	int samprate;
+} ingestfmt_t;
+
+track_t *ingest(const char *name, FILE *fp, const ingestfmt_t *fmt,
+	const unsigned char *prefix, size_t prefixlen, int64_t datalen);
+track_t *ingest_mapped(const char *name, FILE *fp, const ingestfmt_t *fmt,
+	int64_t offset, int64_t datalen);
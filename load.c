@@ -0,0 +1,279 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "errquit.h"
+#include "track.h"
+#include "ingest.h"
+#include "flac.h"
+#include "load.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Skip n bytes of a file, which may be a pipe.
+static void skipbytes(FILE *fp, uint64_t n)
+{
+	char buf[4096];
+
+	if (n <= INT64_MAX && fseeko(fp, (off_t)n, SEEK_CUR) == 0)
+		return;
+	while (n > 0)
+	{
+		const size_t got = fread(buf, 1, MIN(n, sizeof buf), fp);
+		if (got == 0)
+			errquit("unexpected end of file");
+		n -= got;
+	}
+}
+
+/*
+ * Sony Wave64 files use GUIDs for chunk ids, and 64-bit chunk lengths
+ * that count the 24-byte chunk header. The GUIDs of the standard chunks
+ * are the four letters of the RIFF id and then w64tail, except for the
+ * outermost "riff" one.
+ */
+static const unsigned char w64riff[16] = {
+	'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11,
+	0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00
+};
+static const unsigned char w64tail[12] = {
+	0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0,
+	0x4F, 0x8E, 0xDB, 0x8A
+};
+
+/* Length of a RIFF data chunk that goes on until end of file. */
+#define OPEN_ENDED 0xFFFFFFFF
+
+// Does head (the first bytes of a file) look like any kind of wav file?
+static bool iswavhead(const unsigned char *head, size_t headlen)
+{
+	if (headlen < 12)
+		return false;
+	if (memcmp(head, w64riff, 12) == 0)
+		return true;
+	return (memcmp(head, "RIFF", 4) == 0 || memcmp(head, "RF64", 4) == 0)
+		&& memcmp(&head[8], "WAVE", 4) == 0;
+}
+
+/*
+ * Read the header of the next chunk: its id, which for Wave64 is "????"
+ * unless it's a standard chunk, and the length of its body. Returns
+ * false at end of file.
+ */
+static bool readchunkhead(FILE *fp, bool w64, char *id, uint64_t *plen)
+{
+	unsigned char h[24];
+
+	if (!w64) {
+		if (fread(h, 1, 8, fp) != 8)
+			return false;
+		memcpy(id, h, 4);
+		*plen = le32toh(*(uint32_t *)&h[4]);
+		return true;
+	}
+
+	if (fread(h, 1, 24, fp) != 24)
+		return false;
+	memcpy(id, memcmp(&h[4], w64tail, 12) == 0 ? (char *)h : "????", 4);
+	*plen = le64toh(*(uint64_t *)&h[16]);
+	if (*plen < 24)
+		errquit("invalid .w64 file: chunk too short");
+	*plen -= 24;
+	return true;
+}
+
+/*
+ * Read the header of a wav file, up to the start of the sample data,
+ * and work out the sample format and how many bytes of data there are,
+ * or -1 if the data goes on to end of file. Only the headers are read;
+ * the data is left for the caller to stream in or map.
+ * head is the first 12 bytes of the file, already read.
+ *
+ * Plain RIFF files, RF64 files (whose lengths over 4 GB are in a ds64
+ * chunk) and Sony Wave64 files are understood. A RIFF data chunk of
+ * length 0xFFFFFFFF, as written to pipes by streaming encoders like
+ * madplay, goes until end of file.
+ */
+static void readwavheader(const char *name, FILE *fp,
+	const unsigned char *head, size_t headlen,
+	ingestfmt_t *fmt, int64_t *pdatalen)
+{
+	unsigned char fmtchunk[40];
+	unsigned char ds64[24];
+	unsigned char w64head[40 - 12];
+	char id[4];
+	uint64_t fmtchunklen = 0;
+	uint64_t ds64datalen = OPEN_ENDED;
+	uint16_t channels;
+	uint16_t formattag;
+	uint16_t bitdepth;
+	uint64_t chunklen = 0, used;
+	uint32_t wavsamplerate;
+	bool rf64, w64;
+
+	if (!iswavhead(head, headlen))
+		errquit("invalid .wav file: %s", name);
+	rf64 = memcmp(head, "RF64", 4) == 0;
+	w64 = memcmp(head, w64riff, 12) == 0;
+	if (w64) {
+		/* The rest of the riff GUID, its length and the wave GUID. */
+		if (fread(w64head, 1, sizeof w64head, fp) != sizeof w64head
+			|| memcmp(w64head, &w64riff[12], 4) != 0
+			|| memcmp(&w64head[12], "wave", 4) != 0
+			|| memcmp(&w64head[16], w64tail, 12) != 0) {
+			errquit("invalid .w64 file: %s", name);
+		}
+	}
+
+	/* Find data chunk, taking note of the fmt chunk on the way. */
+	while (1) {
+		if (!readchunkhead(fp, w64, id, &chunklen))
+			errquit("wav has no data chunk");
+		if (memcmp(id, "data", 4) == 0) break;
+
+		used = 0;
+		if (memcmp(id, "fmt ", 4) == 0 && chunklen >= 16) {
+			/* Past the extensible part is of no interest. */
+			used = MIN(chunklen, sizeof fmtchunk);
+			if (fread(fmtchunk, 1, used, fp) != used)
+				errquit("invalid .wav file: %s", name);
+			fmtchunklen = used;
+		} else if (rf64 && memcmp(id, "ds64", 4) == 0 &&
+			chunklen >= sizeof ds64) {
+			/* RIFF size, data size, sample count, table... */
+			if (fread(ds64, 1, sizeof ds64, fp) != sizeof ds64)
+				errquit("invalid RF64 file: %s", name);
+			ds64datalen = le64toh(*(uint64_t *)&ds64[8]);
+			used = sizeof ds64;
+		}
+
+		/* Chunks are padded to 2 bytes, or 8 in Wave64. */
+		if (w64)
+			skipbytes(fp, chunklen - used + (-chunklen & 7));
+		else
+			skipbytes(fp, chunklen - used + (chunklen & 1));
+	}
+	if (fmtchunklen == 0)
+		errquit("invalid .wav file: no fmt chunk before data");
+
+	formattag = le16toh(*(uint16_t *)&fmtchunk[0]);
+	channels = le16toh(*(uint16_t *)&fmtchunk[2]);
+	wavsamplerate = le32toh(*(uint32_t *)&fmtchunk[4]);
+	bitdepth = le16toh(*(uint16_t *)&fmtchunk[14]);
+	if (formattag == 0xFFFE && fmtchunklen >= 26)
+		formattag = le16toh(*(uint16_t *)&fmtchunk[24]);
+	if (formattag != 0x0001)
+		errquit("non-PCM wav data: format tag %u", formattag);
+	if (wavsamplerate > 384000)
+		errquit("unsupported sample rate %u", wavsamplerate);
+	if (channels != 2)
+		errquit("non-stereo wav files not supported");
+	if (bitdepth != 16 && bitdepth != 24)
+		errquit("unsupported bit depth: %u", bitdepth);
+
+	fmt->bytespersample = bitdepth / 8;
+	fmt->samprate = (int)wavsamplerate;
+
+	if (rf64 && chunklen == OPEN_ENDED)
+		chunklen = ds64datalen;
+	if (!w64 && chunklen == OPEN_ENDED)
+		*pdatalen = -1;
+	else if (chunklen > INT64_MAX)
+		errquit("invalid .wav file: data chunk too long");
+	else
+		*pdatalen = (int64_t)chunklen;
+}
+
+// Return how many bytes are left to read in a file, or -1 for a pipe.
+static int64_t bytesleft(FILE *fp)
+{
+	struct stat st;
+	off_t at;
+
+	if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) ||
+		(at = ftello(fp)) < 0)
+	{
+		return -1;
+	}
+	return st.st_size - at;
+}
+
+/*
+ * Load a whole file (already opened) and make a track out of it.
+ * Raw files are taken to be at samprate.
+ */
+track_t *loadtrack(const char *filename, FILE *fp, bool forceraw,
+	int samprate)
+{
+	unsigned char head[12];
+	size_t headlen;
+	bool iswav, isflac;
+	ingestfmt_t fmt;
+	int64_t datalen = -1;
+	off_t at;
+	track_t *t = NULL;
+
+	headlen = fread(head, 1, sizeof head, fp);
+
+	/*
+	 * Is it a wav or FLAC file? On stdin, sniff; from file, check
+	 * extension.
+	 */
+	if (forceraw)
+		iswav = isflac = false;
+	else if (fp == stdin)
+	{
+		iswav = iswavhead(head, headlen);
+		isflac = isflachead(head, headlen);
+	}
+	else
+	{
+		const char *const ext = strrchr(filename, '.');
+
+		iswav = ext != NULL && (strcasecmp(ext, ".wav") == 0
+			|| strcasecmp(ext, ".w64") == 0
+			|| strcasecmp(ext, ".rf64") == 0);
+		isflac = ext != NULL && strcasecmp(ext, ".flac") == 0;
+	}
+
+	if (isflac)
+	{
+		t = loadflac(filename, fp, head, headlen);
+		if (fp != stdin)
+			fclose(fp);
+		return t;
+	}
+
+	if (iswav)
+	{
+		readwavheader(filename, fp, head, headlen, &fmt, &datalen);
+		headlen = 0; /* The header isn't sample data. */
+		if (datalen < 0)
+			datalen = bytesleft(fp); // Still -1 for a pipe.
+	}
+	else
+	{
+		fmt.bytespersample = 2;
+		fmt.samprate = samprate;
+		datalen = bytesleft(fp);
+		if (datalen >= 0)
+			datalen += headlen;
+	}
+
+	/* Data in a regular file may be usable where it lies. */
+	if (datalen >= 0 && (at = ftello(fp)) >= 0)
+	{
+		t = ingest_mapped(filename, fp, &fmt, (int64_t)at - headlen,
+			datalen);
+	}
+	if (t == NULL)
+		t = ingest(filename, fp, &fmt, head, headlen, datalen);
+	if (fp != stdin)
+		fclose(fp);
+	return t;
+}
+
@@ -0,0 +1,5 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+track_t *loadtrack(const char *filename, FILE *fp, bool forceraw,
+	int samprate);
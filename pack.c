@@ -0,0 +1,403 @@
+#include <endian.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xm.h"
+#include "pool.h"
+#include "track.h"
+#include "pack.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+/*
+ * Packed sample storage. Once a track's summaries are filled in, its
+ * samples are only looked at for the ends of queries and at close
+ * zooms, so they can be kept compressed, block by block, and unpacked
+ * a block at a time when they're needed.
+ *
+ * Each channel of a block is cut into groups of PACK_GROUP samples. A
+ * group is predicted from the samples before it, either by the last
+ * one or by a line through the last two, whichever leaves the smaller
+ * residuals. The residuals are zigzagged (0, -1, 1, -2, ... become 0,
+ * 1, 2, 3, ...) and stored in as few bits each as the biggest needs,
+ * after a byte giving the predictor and the width. A block that comes
+ * out no smaller than it was is stored as it is.
+ *
+ * Unpacked blocks go into a small cache shared by all threads, which
+ * drops the least recently used. Each thread also keeps the last block
+ * it looked at, so a scan through a block only goes to the shared
+ * cache once.
+ */
+
+#define PACK_GROUP 64
+#define PACK_GROUPS (SAMPLES_PER_BLOCK / PACK_GROUP)
+#define PACK_MAXWIDTH 18 // A residual of 16-bit samples, zigzagged.
+#define PACK_MAXBLOCK (2 * PACK_GROUPS * (1 + PACK_GROUP*PACK_MAXWIDTH/8))
+#define BLOCK_BYTES (SAMPLES_PER_BLOCK * 2 * sizeof (int16_t))
+#define PACK_CHUNK 256 // Blocks packed by each pool job.
+#define PACK_SLACK 8 // Bytes after the packed data, for unaligned loads.
+
+#define CACHE_BLOCKS 256
+#define CACHE_BUCKETS (2 * CACHE_BLOCKS)
+
+static inline uint32_t zigzag(int v)
+{
+	return (uint32_t)v << 1 ^ (uint32_t)(v >> 31);
+}
+
+static inline int unzigzag(uint32_t v)
+{
+	return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+static int bitwidth(uint32_t v)
+{
+	int n = 0;
+
+	while (v != 0)
+		n++, v >>= 1;
+	return n;
+}
+
+/*
+ * Pack the n frames of a block (n may be short for the last block)
+ * into out, which has room for PACK_MAXBLOCK bytes. Returns the number
+ * of bytes used.
+ */
+static size_t packblock(const int16_t *frames, int n, unsigned char *out)
+{
+	unsigned char *p = out;
+	int ch, g, i;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		int last = 0, beforelast = 0;
+
+		for (g = 0; g < PACK_GROUPS; g++)
+		{
+			uint32_t r1[PACK_GROUP], r2[PACK_GROUP];
+			uint32_t bits1 = 0, bits2 = 0;
+			const uint32_t *r;
+			int a = last, b = beforelast, width, line;
+			uint64_t acc = 0;
+			int nacc = 0;
+
+			for (i = 0; i < PACK_GROUP; i++)
+			{
+				const int k = g * PACK_GROUP + i;
+				const int s = k < n ? frames[k*2 + ch] : 0;
+
+				r1[i] = zigzag(s - a);
+				r2[i] = zigzag(s - 2*a + b);
+				bits1 |= r1[i];
+				bits2 |= r2[i];
+				b = a;
+				a = s;
+			}
+			last = a;
+			beforelast = b;
+
+			line = bitwidth(bits2) < bitwidth(bits1);
+			r = line ? r2 : r1;
+			width = bitwidth(line ? bits2 : bits1);
+			*p++ = (unsigned char)(line << 7 | width);
+
+			// A group is always a whole number of bytes.
+			for (i = 0; i < PACK_GROUP; i++)
+			{
+				acc |= (uint64_t)r[i] << nacc;
+				for (nacc += width; nacc >= 8; nacc -= 8)
+				{
+					*p++ = (unsigned char)acc;
+					acc >>= 8;
+				}
+			}
+		}
+	}
+	return (size_t)(p - out);
+}
+
+// Unpack a block of len bytes into a whole block of frames.
+static void unpackblock(const unsigned char *in, size_t len, int16_t *frames)
+{
+	const unsigned char *p = in;
+	int ch, g, i;
+
+	if (len == BLOCK_BYTES)
+	{
+		memcpy(frames, in, BLOCK_BYTES);
+		return;
+	}
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		int last = 0, beforelast = 0;
+
+		for (g = 0; g < PACK_GROUPS; g++)
+		{
+			const bool line = *p >> 7;
+			const int width = *p++ & 0x7F;
+			const uint32_t mask = (1u << width) - 1;
+			int16_t *const out = &frames[g * PACK_GROUP * 2 + ch];
+
+			for (i = 0; i < PACK_GROUP; i++)
+			{
+				const int bit = i * width;
+				uint64_t word;
+				int s;
+
+				memcpy(&word, &p[bit >> 3], sizeof word);
+				s = unzigzag((uint32_t)(le64toh(word)
+					>> (bit & 7)) & mask);
+				s += line ? 2*last - beforelast : last;
+				out[i*2] = (int16_t)s;
+				beforelast = last;
+				last = s;
+			}
+			p += PACK_GROUP * width / 8;
+		}
+	}
+}
+
+/* Blocks packed by the pool, PACK_CHUNK at a time. */
+typedef struct
+{
+	const track_t *t;
+	unsigned char **chunks; // Each chunk's packed blocks, back to back.
+	size_t *sizes; // Of each block.
+} packjob_t;
+
+static void packchunk(void *arg, int i)
+{
+	packjob_t *const job = arg;
+	const track_t *const t = job->t;
+	const int numblocks = t->levels[0].numnodes;
+	const int last = MIN((i+1) * PACK_CHUNK, numblocks);
+	unsigned char *buf = xm(PACK_MAXBLOCK, PACK_CHUNK);
+	size_t used = 0;
+	int b;
+
+	for (b = i * PACK_CHUNK; b < last; b++)
+	{
+		const int first = b * SAMPLES_PER_BLOCK;
+		const int n = MIN(SAMPLES_PER_BLOCK, t->numsamples - first);
+		const int16_t *const frames = &t->samples[(size_t)first * 2];
+		size_t size = packblock(frames, n, &buf[used]);
+
+		if (size >= BLOCK_BYTES)
+		{
+			memset(&buf[used], 0, BLOCK_BYTES);
+			memcpy(&buf[used], frames, (size_t)n * 4);
+			size = BLOCK_BYTES;
+		}
+		job->sizes[b] = size;
+		used += size;
+	}
+	job->chunks[i] = xr(buf, 1, used + 1);
+}
+
+/*
+ * Swap a track's samples for packed ones, using the whole worker pool.
+ * Its summaries are filled in first, as filling them in later would
+ * take unpacking every block. Mapped samples are left as they are, as
+ * they take no memory to speak of.
+ */
+void track_pack(track_t *t)
+{
+	const int numblocks = t->levels[0].numnodes;
+	const int nchunks = (numblocks + PACK_CHUNK - 1) / PACK_CHUNK;
+	const size_t rawbytes = (size_t)t->numsamples * 2 * sizeof *t->samples;
+	packjob_t job;
+	size_t total = 0, packedbytes;
+	int i, b;
+
+	if (t->mapping != NULL || t->packed != NULL || numblocks == 0)
+		return;
+	track_fillall(t);
+
+	job.t = t;
+	job.chunks = xm(sizeof *job.chunks, nchunks);
+	job.sizes = xm(sizeof *job.sizes, numblocks);
+	pool_for(packchunk, &job, nchunks);
+
+	for (b = 0; b < numblocks; b++)
+		total += job.sizes[b];
+	packedbytes = total + PACK_SLACK
+		+ (numblocks + 1) * sizeof *t->packedat;
+
+	t->packed = xm(1, total + PACK_SLACK);
+	t->packedat = xm(sizeof *t->packedat, numblocks + 1);
+	t->packedat[0] = 0;
+	for (i = 0, b = 0; i < nchunks; i++)
+	{
+		const size_t at = t->packedat[b];
+		size_t len = 0;
+		int last = MIN((i+1) * PACK_CHUNK, numblocks);
+
+		for (; b < last; b++)
+		{
+			len += job.sizes[b];
+			t->packedat[b+1] = t->packedat[b] + job.sizes[b];
+		}
+		memcpy(&t->packed[at], job.chunks[i], len);
+		free(job.chunks[i]);
+	}
+	memset(&t->packed[total], 0, PACK_SLACK);
+	free(job.chunks);
+	free(job.sizes);
+
+	free(t->samples);
+	t->samples = NULL;
+	track_uncharge(rawbytes);
+	t->membytes -= rawbytes;
+	track_charge(packedbytes, t->name);
+	t->membytes += packedbytes;
+}
+
+/*
+ * The cache of unpacked blocks: a hash table of slots, keyed by track
+ * id and block, with the slots also in a list from most to least
+ * recently used. Slots not in use have track id 0.
+ */
+typedef struct
+{
+	unsigned id;
+	int block;
+	int prev, next; // In the list, or -1 at the ends.
+	int hashnext; // Next in the same bucket, or -1.
+	int16_t frames[SAMPLES_PER_BLOCK * 2];
+} slot_t;
+
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cacheonce = PTHREAD_ONCE_INIT;
+static slot_t *slots;
+static int buckets[CACHE_BUCKETS];
+static int mru, lru; // Ends of the list.
+
+static void initcache(void)
+{
+	int i;
+
+	slots = xm(sizeof *slots, CACHE_BLOCKS);
+	for (i = 0; i < CACHE_BLOCKS; i++)
+	{
+		slots[i].id = 0;
+		slots[i].prev = i - 1;
+		slots[i].next = i + 1 < CACHE_BLOCKS ? i + 1 : -1;
+		slots[i].hashnext = -1;
+	}
+	for (i = 0; i < CACHE_BUCKETS; i++)
+		buckets[i] = -1;
+	mru = 0;
+	lru = CACHE_BLOCKS - 1;
+}
+
+static int bucketof(unsigned id, int block)
+{
+	return (int)((id * 2654435761u ^ (unsigned)block * 40503u)
+		% CACHE_BUCKETS);
+}
+
+// Move a slot to the front of the list. Call with cachelock held.
+static void touch(int i)
+{
+	slot_t *const s = &slots[i];
+
+	if (i == mru)
+		return;
+	slots[s->prev].next = s->next;
+	if (s->next >= 0)
+		slots[s->next].prev = s->prev;
+	else
+		lru = s->prev;
+	s->prev = -1;
+	s->next = mru;
+	slots[mru].prev = i;
+	mru = i;
+}
+
+// Find a block in the cache, or return -1. Call with cachelock held.
+static int lookup(unsigned id, int block)
+{
+	int i;
+
+	for (i = buckets[bucketof(id, block)]; i >= 0; i = slots[i].hashnext)
+		if (slots[i].id == id && slots[i].block == block)
+			return i;
+	return -1;
+}
+
+// Put a block in the cache, instead of the least recently used one.
+static void insert(unsigned id, int block, const int16_t *frames)
+{
+	const int i = lru;
+	slot_t *const s = &slots[i];
+	int *link;
+
+	if (s->id != 0)
+	{
+		for (link = &buckets[bucketof(s->id, s->block)]; *link != i;
+			link = &slots[*link].hashnext)
+			;
+		*link = s->hashnext;
+	}
+
+	s->id = id;
+	s->block = block;
+	memcpy(s->frames, frames, sizeof s->frames);
+	link = &buckets[bucketof(id, block)];
+	s->hashnext = *link;
+	*link = i;
+	touch(i);
+}
+
+// Get a whole block of a packed track's frames into frames.
+static void getblock(const track_t *t, int block, int16_t *frames)
+{
+	int i;
+
+	pthread_once(&cacheonce, initcache);
+	pthread_mutex_lock(&cachelock);
+	if ((i = lookup(t->id, block)) >= 0)
+	{
+		memcpy(frames, slots[i].frames, sizeof slots[i].frames);
+		touch(i);
+		pthread_mutex_unlock(&cachelock);
+		return;
+	}
+	pthread_mutex_unlock(&cachelock);
+
+	unpackblock(&t->packed[t->packedat[block]],
+		t->packedat[block+1] - t->packedat[block], frames);
+
+	pthread_mutex_lock(&cachelock);
+	if (lookup(t->id, block) < 0)
+		insert(t->id, block, frames);
+	pthread_mutex_unlock(&cachelock);
+}
+
+/* The block each thread looked at last. */
+static __thread unsigned lastid = 0;
+static __thread int lastblock;
+static __thread int16_t lastframes[SAMPLES_PER_BLOCK * 2];
+
+/*
+ * Return frame n of a packed track (its left sample, then its right).
+ * The rest of its block follows it. It stays there until the calling
+ * thread looks at another block.
+ */
+const int16_t *pack_frame(const track_t *t, int n)
+{
+	const int block = n / SAMPLES_PER_BLOCK;
+
+	if (t->id != lastid || block != lastblock)
+	{
+		getblock(t, block, lastframes);
+		lastid = t->id;
+		lastblock = block;
+	}
+	return &lastframes[(size_t)(n % SAMPLES_PER_BLOCK) * 2];
+}
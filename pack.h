@@ -0,0 +1,2 @@
+void track_pack(track_t *t);
+const int16_t *pack_frame(const track_t *t, int n);
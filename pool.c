@@ -0,0 +1,161 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+/*
+ * A small pool of worker threads shared by everything that wants to
+ * run in parallel. It does two kinds of work:
+ *
+ * pool_for() runs fn(arg, 0) .. fn(arg, n-1) across the workers and
+ * the calling thread, and returns when all of them are done. This is
+ * used for things that must finish within a frame.
+ *
+ * When there's nothing like that to do, the workers call the idle
+ * function over and over until it returns false, meaning there is no
+ * more background work. pool_kick() tells them there may be more.
+ */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t forlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t fordone = PTHREAD_COND_INITIALIZER;
+
+static int numthreads = 0;
+
+static void (*forfn)(void *arg, int i);
+static void *forarg;
+static int fornext, forcount, forleft;
+
+static bool (*idlefn)(void);
+static bool idlebusy = false; // Might the idle function have work?
+static unsigned idlegen = 0; // Bumped by every pool_kick().
+
+// Take one pool_for() item if there is one. Call with lock held.
+static bool runforitem(void)
+{
+	void (*fn)(void *, int) = forfn;
+	void *arg = forarg;
+	int i;
+
+	if (fn == NULL || fornext >= forcount)
+		return false;
+	i = fornext++;
+
+	pthread_mutex_unlock(&lock);
+	fn(arg, i);
+	pthread_mutex_lock(&lock);
+
+	if (--forleft == 0)
+		pthread_cond_broadcast(&fordone);
+	return true;
+}
+
+static void *worker(void *unused)
+{
+	(void)unused;
+
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		unsigned gen;
+		bool more;
+
+		if (runforitem())
+			continue;
+
+		if (!idlebusy || idlefn == NULL)
+		{
+			pthread_cond_wait(&wake, &lock);
+			continue;
+		}
+
+		gen = idlegen;
+		pthread_mutex_unlock(&lock);
+		more = idlefn();
+		pthread_mutex_lock(&lock);
+		if (!more && gen == idlegen)
+			idlebusy = false;
+	}
+	return NULL;
+}
+
+int pool_numcpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return (int)n;
+#endif
+	return 1;
+}
+
+// How many workers there are, not counting callers of pool_for().
+int pool_numthreads(void)
+{
+	return numthreads;
+}
+
+// Start nthreads workers. With 0, everything runs in the caller.
+void pool_init(int nthreads)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, worker, NULL) != 0)
+			break;
+		pthread_detach(thread);
+	}
+	numthreads = i;
+}
+
+void pool_for(void (*fn)(void *arg, int i), void *arg, int n)
+{
+	int i;
+
+	if (numthreads == 0)
+	{
+		for (i = 0; i < n; i++)
+			fn(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&forlock);
+	pthread_mutex_lock(&lock);
+	forfn = fn;
+	forarg = arg;
+	fornext = 0;
+	forcount = forleft = n;
+	pthread_cond_broadcast(&wake);
+
+	while (runforitem())
+		;
+	while (forleft > 0)
+		pthread_cond_wait(&fordone, &lock);
+
+	forfn = NULL;
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&forlock);
+}
+
+void pool_setidle(bool (*fn)(void))
+{
+	pthread_mutex_lock(&lock);
+	idlefn = fn;
+	pthread_mutex_unlock(&lock);
+	pool_kick();
+}
+
+void pool_kick(void)
+{
+	pthread_mutex_lock(&lock);
+	idlebusy = true;
+	idlegen++;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+}
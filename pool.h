@@ -0,0 +1,8 @@
+#include <stdbool.h>
+
+void pool_init(int nthreads);
+void pool_for(void (*fn)(void *arg, int i), void *arg, int n);
+void pool_setidle(bool (*fn)(void));
+void pool_kick(void);
+int pool_numcpus(void);
+int pool_numthreads(void);
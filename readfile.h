@@ -1,3 +0,0 @@
-#include <stdint.h>
-
-void *readfile(FILE *fp, uint32_t *len);
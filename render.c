@@ -0,0 +1,851 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __OpenBSD__
+#include <float.h> /* XXX: for DBL_EPSILON but dunno if non-BSD OSes have it */
+#endif
+
+#include <allegro.h>
+#include "xm.h"
+#include "pool.h"
+#include "track.h"
+#include "render.h"
+
+/* XXX */
+#ifndef DBL_EPSILON
+#define DBL_EPSILON 2.2204460492503131E-16
+#endif
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+enum
+{
+	BLACK = 0, BLUE, GREEN, CYAN, RED, MAGENTA, BROWN,
+	LIGHT_GRAY, GRAY, LIGHT_BLUE, LIGHT_GREEN, LIGHT_CYAN,
+	LIGHT_RED, LIGHT_MAGENTA, YELLOW, WHITE
+};
+
+#define SCREEN_BG GRAY
+#define CHANNEL_BG BLACK
+#define CHANNEL_LOG_PEAK_COLOR LIGHT_GREEN
+#define CHANNEL_LIN_PEAK_COLOR LIGHT_GREEN
+#define CHANNEL_LOG_RMS_COLOR LIGHT_CYAN
+#define CHANNEL_LIN_RMS_COLOR CYAN
+#define CHANNEL_DCLINE_COLOR LIGHT_GRAY
+#define CHANNEL_LOGGUIDE_COLOR_MAJOR (makecol(120, 120, 120))
+#define CHANNEL_LOGGUIDE_COLOR_MINOR (makecol(92, 92, 92))
+#define CHANNEL_LOGGUIDE_SPACING 6 // 6 dB between guide lines.
+#define CHANNEL_LOGGUIDE_MAJOR_SPACING (2*CHANNEL_LOGGUIDE_SPACING)
+#define MAX_DB_RANGE 96.0
+#define CHANNEL_TRUEPEAK_COLOR LIGHT_MAGENTA
+#define CHANNEL_OVER_COLOR LIGHT_RED
+#define OVER_MARK_HEIGHT 3
+#define CHANNEL_CORR_COLOR YELLOW
+#define CHANNEL_ANTICORR_COLOR LIGHT_RED
+#define CORR_FRACTION 6 // Correlation lane gets 1/this of the screen.
+#define MARKER_FG WHITE
+#define MARKER_TEXT WHITE
+#define SELECTION_BG BLUE
+#define STATS_TEXT WHITE
+#define HIST_COLOR LIGHT_GREEN
+#define HIST_REST_COLOR GRAY // The bin of everything quieter.
+#define HIST_BORDER LIGHT_GRAY
+#define HIST_BAR_WIDTH 8 // Pixels per bin, with a gap of 2.
+#define HIST_BAR_HEIGHT 40
+
+#define RMS_MIN_SAMPLES(rate) ((int)(rate * 0.001))
+
+
+/* Draw a column of a channel of audio. */
+static void drawcolumn(view_t *v, int x, int top, int height,
+	int min, int max, int rms)
+{
+	int y1, y2;
+	const int lasty1 = rms ? v->lastrmsy1 : v->lastpeaky1;
+	const int lasty2 = rms ? v->lastrmsy2 : v->lastpeaky2;
+	int color;
+
+	if (!v->logdisp) /* Linear display. */
+	{
+		int scalecount;
+		int ycenter = top + height/2;
+
+		for (scalecount = v->vzoom; scalecount > 0; scalecount--)
+		{
+			min *= 2;
+			max *= 2;
+		}
+
+		y1 = ycenter - (int)(max * height/2 / SAMP_DIV_FLOAT);
+		y2 = ycenter - (int)(min * height/2 / SAMP_DIV_FLOAT);
+	}
+	else /* Logarithmic display. */
+	{
+		double maxdb, mindb;
+
+		/* Avoid negative infinity when taking logs. */
+		if (max == 0) max = 1;
+		if (min == 0) min = 1;
+
+		maxdb = 20.0 * log10((double)abs(max) / SAMP_DIV_FLOAT);
+		mindb = 20.0 * log10((double)abs(min) / SAMP_DIV_FLOAT);
+
+		// When drawing logarithmic peak graphs, don't allow
+		// asymmetry to fubar the display.
+		if (!rms)
+		{
+			if (mindb < maxdb)
+				mindb = maxdb;
+			else
+				maxdb = mindb;
+		}
+
+		/*
+		 * XXX is this clamping necessary? should it be?
+		 * Note: 96 dB is maximum dynamic range of 16-bit
+		 * samples, in theory.
+		 */
+		if (maxdb > 0.0) maxdb = 0.0;
+		if (mindb < -MAX_DB_RANGE) mindb = -MAX_DB_RANGE;
+
+		y1 = (int)(top - mindb * height / MAX_DB_RANGE);
+		y2 = (int)(top - maxdb * height / MAX_DB_RANGE);
+	}
+
+	/* Make y1 the one on top. */
+	if (y1 > y2)
+	{
+		const int tmp = y2;
+		y2 = y1;
+		y1 = tmp;
+	}
+
+	/*
+	 * Connect this line to the last line, to avoid the
+	 * "scatterplot" look when zoomed in.
+	 */
+	if (v->chan_i > 0)
+	{
+		if (y2 < lasty1 - 1)
+			y2 = lasty1 - 1;
+		else if (y1 > lasty2 + 1)
+			y1 = lasty2 + 1;
+	}
+
+	if (rms)
+	{
+		if (v->logdisp) color = CHANNEL_LOG_RMS_COLOR;
+		else color = CHANNEL_LIN_RMS_COLOR;
+	}
+	else if (v->logdisp) color = CHANNEL_LOG_PEAK_COLOR;
+	else color = CHANNEL_LIN_PEAK_COLOR;
+
+	vline(v->buffer, x, y1, y2, color);
+
+	if (rms)
+	{
+		v->lastrmsy1 = y1;
+		v->lastrmsy2 = y2;
+	}
+	else
+	{
+		v->lastpeaky1 = y1;
+		v->lastpeaky2 = y2;
+	}
+}
+
+/*
+ * Draw a column of the true peak trace: a dot at the true peak level
+ * (two in linear view, above and below the centre line), joined to the
+ * last column's. A true peak over full scale is also marked at the
+ * edge of the lane.
+ */
+static void drawtruepeak(view_t *v, int x, int top, int height, float level)
+{
+	int y1, y2;
+
+	if (level > SAMP_DIV_FLOAT)
+	{
+		vline(v->buffer, x, top, top + OVER_MARK_HEIGHT - 1,
+			CHANNEL_OVER_COLOR);
+		if (!v->logdisp)
+		{
+			vline(v->buffer, x, top + height - OVER_MARK_HEIGHT,
+				top + height - 1, CHANNEL_OVER_COLOR);
+		}
+	}
+
+	if (!v->logdisp)
+	{
+		const int off = (int)MIN(level * ldexp(1.0, v->vzoom)
+			* height / 2 / SAMP_DIV_FLOAT, height);
+
+		y1 = top + height/2 - off;
+		y2 = top + height/2 + off;
+	}
+	else
+	{
+		double db = 20.0 * log10(MAX(level, 1.0f) / SAMP_DIV_FLOAT);
+
+		if (db > 0.0) db = 0.0;
+		if (db < -MAX_DB_RANGE) db = -MAX_DB_RANGE;
+		y1 = y2 = (int)(top - db * height / MAX_DB_RANGE);
+	}
+
+	if (v->chan_i == 0)
+	{
+		v->lasttpy1 = y1;
+		v->lasttpy2 = y2;
+	}
+	vline(v->buffer, x, MIN(y1, v->lasttpy1), MAX(y1, v->lasttpy1),
+		CHANNEL_TRUEPEAK_COLOR);
+	if (!v->logdisp)
+	{
+		vline(v->buffer, x, MIN(y2, v->lasttpy2),
+			MAX(y2, v->lasttpy2), CHANNEL_TRUEPEAK_COLOR);
+	}
+	v->lasttpy1 = y1;
+	v->lasttpy2 = y2;
+}
+
+/* Number of columns each pool job works out. */
+#define COLUMN_CHUNK 64
+
+/* If there are too few samples for each column, skip RMS. */
+static int skiprms(const view_t *v, const track_t *t)
+{
+	return v->rmsdisp ? (v->zoom < RMS_MIN_SAMPLES(t->samprate)) : 1;
+}
+
+/* The parts of a column_t that are worked out, as needed. */
+#define COL_PEAK 1
+#define COL_RMS 2
+#define COL_CORR 4
+#define COL_TRUEPEAK 8
+
+/*
+ * Recently worked out columns, so that going back to an earlier view
+ * (zooming back out, paging back) takes no summary queries. It's
+ * direct mapped: each column can only go in one entry, and a newer
+ * column that goes there replaces it.
+ */
+#define COLCACHE_SIZE 16384 // Entries; a power of 2.
+
+typedef struct
+{
+	/* The key. */
+	double zoom;
+	int track; // Index into the view's tracks.
+	int start, num; // Samples covered.
+	bool ms; // Mid/side rather than left/right?
+	int numsamples; // Of the track then; if it grows, columns change.
+
+	unsigned what; // Which parts of col are there, or 0 if none.
+	column_t col;
+} colcacheent_t;
+
+struct colcache
+{
+	pthread_mutex_t lock;
+	colcacheent_t ent[COLCACHE_SIZE];
+};
+
+/*
+ * The entry for the column starting at sample start. Neighbouring
+ * columns go in neighbouring entries, from a place that depends on the
+ * rest of the key, so the columns of a screen don't push each other
+ * out.
+ */
+static colcacheent_t *colcachefind(const view_t *v, int track, int start)
+{
+	const uint64_t column = (uint64_t)(int64_t)floor(start / v->zoom + 0.5);
+	uint64_t h;
+
+	memcpy(&h, &v->zoom, sizeof h);
+	h ^= (uint64_t)track << 1 ^ (v->msdisp != 0);
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 32;
+	return &v->cache->ent[(h + column) & (COLCACHE_SIZE - 1)];
+}
+
+static bool colcachematch(const view_t *v, const colcacheent_t *e,
+	int track, int start, int num)
+{
+	return e->what != 0 && e->zoom == v->zoom && e->track == track
+		&& e->start == start && e->num == num
+		&& e->ms == (v->msdisp != 0)
+		&& e->numsamples == v->tracks[track]->numsamples;
+}
+
+/*
+ * Work out the given parts of the column covering num samples from
+ * start. Columns shorter than RMS_MIN_SAMPLES are widened for the
+ * correlation so its trace isn't just noise.
+ */
+static void workoutcolumn(const view_t *v, track_t *t, column_t *c,
+	int start, int num, unsigned what)
+{
+	const int firstchan = v->msdisp ? CHAN_MID : CHAN_LEFT;
+	const int minsamples = MAX(RMS_MIN_SAMPLES(t->samprate), 1);
+	int ch;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if (what & COL_PEAK)
+		{
+			getminmax(t, firstchan + ch, start, num,
+				&c->min[ch], &c->max[ch]);
+		}
+		if (what & COL_RMS)
+		{
+			c->rms[ch] = (int)(SAMP_DIV_FLOAT * calcrms(t,
+				firstchan + ch, start, num));
+		}
+		if (what & COL_TRUEPEAK)
+			c->truepeak[ch] = (float)calctruepeak(t, ch, start, num);
+	}
+
+	if (what & COL_CORR)
+	{
+		int corrstart = start, corrnum = num;
+
+		if (corrnum < minsamples)
+		{
+			corrstart -= (minsamples - corrnum) / 2;
+			corrnum = minsamples;
+			if (corrstart < 0)
+				corrstart = 0;
+		}
+		c->hascorr = corrstart < t->numsamples;
+		if (c->hascorr)
+			c->corr = calccorr(t, corrstart, corrnum);
+	}
+}
+
+/*
+ * Work out the summaries for one chunk of columns of one track, for
+ * pool_for(). Chunks are numbered across all tracks, top to bottom.
+ * Whatever the column cache has isn't worked out again.
+ */
+static void computecolumns(void *arg, int i)
+{
+	view_t *const v = arg;
+	const int chunks = (v->width + COLUMN_CHUNK - 1) / COLUMN_CHUNK;
+	const int track = i / chunks;
+	track_t *const t = v->tracks[track];
+	column_t *const row = &v->columns[track * v->width];
+	const int first = i % chunks * COLUMN_CHUNK;
+	const int last = MIN(first + COLUMN_CHUNK, v->width);
+	const unsigned need = (v->peakdisp ? COL_PEAK : 0)
+		| (skiprms(v, t) ? 0 : COL_RMS) | (v->corrdisp ? COL_CORR : 0)
+		| (v->tpdisp && !v->msdisp ? COL_TRUEPEAK : 0);
+	int x;
+
+	for (x = first; x < last; x++)
+	{
+		column_t *const c = &row[x];
+		const int start = v->pos + (int)(x * v->zoom);
+		const int num = v->pos + (int)((x+1) * v->zoom) - start;
+		colcacheent_t *e;
+		unsigned cached = 0;
+
+		if (v->cache == NULL)
+		{
+			workoutcolumn(v, t, c, start, num, need);
+			continue;
+		}
+
+		e = colcachefind(v, track, start);
+		pthread_mutex_lock(&v->cache->lock);
+		if (colcachematch(v, e, track, start, num))
+		{
+			*c = e->col;
+			cached = e->what;
+		}
+		pthread_mutex_unlock(&v->cache->lock);
+
+		if ((need & ~cached) == 0)
+			continue;
+		workoutcolumn(v, t, c, start, num, need & ~cached);
+
+		pthread_mutex_lock(&v->cache->lock);
+		e->zoom = v->zoom;
+		e->track = track;
+		e->start = start;
+		e->num = num;
+		e->ms = v->msdisp != 0;
+		e->numsamples = t->numsamples;
+		e->what = cached | need;
+		if (c->truepeak[0] < 0.0f) // Not known yet, so ask again.
+			e->what &= ~COL_TRUEPEAK;
+		e->col = *c;
+		pthread_mutex_unlock(&v->cache->lock);
+	}
+}
+
+// Get the first sample of pixel column x.
+int colsample(const view_t *v, int x)
+{
+	return v->pos + (int)(x * v->zoom);
+}
+
+// Shade the selected columns of a lane's background.
+static void drawselection(view_t *v, int top, int height, int left, int cols)
+{
+	int x1, x2;
+
+	if (!v->hassel)
+		return;
+
+	x1 = MAX((int)floor((v->selstart - v->pos) / v->zoom), 0);
+	x2 = MIN((int)floor((v->selend - 1 - v->pos) / v->zoom), cols - 1);
+	if (x1 <= x2)
+	{
+		rectfill(v->buffer, left + x1, top, left + x2, top + height - 1,
+			SELECTION_BG);
+	}
+}
+
+/*
+ * Draw a channel of audio.
+ * top = topmost pixel, height = height, left = leftmost pixel,
+ * cols = number of columns, row = their summaries,
+ * ch = which of the two displayed channels to draw.
+ */
+static void drawchannel(view_t *v, int top, int height, int left, int cols,
+	const column_t *row, int ch, int norms)
+{
+	set_clip_rect(v->buffer, left, top, left + cols - 1, top + height - 1);
+
+	if (!(height & 1)) height--; /* force an odd height */
+
+	v->lastpeaky1 = v->lastpeaky2 = top + height/2;
+	v->lastrmsy1 = v->lastrmsy2 = top + height/2;
+
+	rectfill(v->buffer, left, top, left + cols - 1, top + height - 1,
+		CHANNEL_BG);
+	drawselection(v, top, height, left, cols);
+
+	if (v->logdisp)
+	{
+		int ix;
+		for (ix = CHANNEL_LOGGUIDE_SPACING; ix < MAX_DB_RANGE;
+			ix += CHANNEL_LOGGUIDE_SPACING)
+		{
+			const int y = (int)(top + ix * height / MAX_DB_RANGE);
+			hline(v->buffer, left, y, left + cols - 1,
+				ix % CHANNEL_LOGGUIDE_MAJOR_SPACING == 0
+					? CHANNEL_LOGGUIDE_COLOR_MAJOR
+					: CHANNEL_LOGGUIDE_COLOR_MINOR);
+		}
+	}
+	else
+	{
+		hline(v->buffer, left, top + height/2, left + cols - 1,
+			CHANNEL_DCLINE_COLOR);
+	}
+
+	for (v->chan_i = 0; v->chan_i < cols; v->chan_i++)
+	{
+		const column_t *const c = &row[v->chan_i];
+
+		if (v->peakdisp)
+		{
+			drawcolumn(v, v->chan_i + left, top, height,
+				c->min[ch], c->max[ch], 0);
+		}
+
+		if (!norms)
+		{
+			drawcolumn(v, v->chan_i + left, top, height,
+				-c->rms[ch], c->rms[ch], 1);
+		}
+
+		if (v->tpdisp && !v->msdisp && c->truepeak[ch] >= 0.0f)
+		{
+			drawtruepeak(v, v->chan_i + left, top, height,
+				c->truepeak[ch]);
+		}
+	}
+
+	set_clip_rect(v->buffer, 0, 0, v->buffer->w, v->buffer->h);
+}
+
+/*
+ * Draw the left/right correlation coefficient as a trace from +1 (top)
+ * to -1 (bottom). Arguments are as for drawchannel().
+ */
+static void drawcorrelation(view_t *v, int top, int height, int left, int cols,
+	const column_t *row)
+{
+	const int ycenter = top + height/2;
+	int lasty = ycenter;
+	int x;
+
+	set_clip_rect(v->buffer, left, top, left + cols - 1, top + height - 1);
+	rectfill(v->buffer, left, top, left + cols - 1, top + height - 1,
+		CHANNEL_BG);
+	drawselection(v, top, height, left, cols);
+	hline(v->buffer, left, ycenter, left + cols - 1, CHANNEL_DCLINE_COLOR);
+
+	for (x = 0; x < cols && row[x].hascorr; x++)
+	{
+		const double corr = row[x].corr;
+		const int y = ycenter - (int)(corr * (height/2 - 1));
+
+		vline(v->buffer, x + left, x > 0 ? lasty : y, y,
+			corr < 0.0 ? CHANNEL_ANTICORR_COLOR
+				: CHANNEL_CORR_COLOR);
+		lasty = y;
+	}
+
+	set_clip_rect(v->buffer, 0, 0, v->buffer->w, v->buffer->h);
+}
+
+/* A color as 0xRRGGBB, whatever the color depth. */
+static uint32_t torgb(int color)
+{
+	return (uint32_t)getr(color) << 16 | getg(color) << 8 | getb(color);
+}
+
+/*
+ * Write text into the buffer. If the view has a text hash, the text,
+ * its place and its colors go into that instead (32-bit FNV-1a), so
+ * that render hashes don't depend on the font.
+ */
+static void drawtext(view_t *v, int x, int y, int fg, int bg,
+	const char *fmt, ...)
+{
+	const uint32_t fields[] = { x, y, torgb(fg),
+		bg < 0 ? 0xffffffffu : torgb(bg) }; // -1 is no background.
+	char buf[200];
+	va_list ap;
+	int i;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	if (v->texthash == NULL)
+	{
+		textout_ex(v->buffer, font, buf, x, y, fg, bg);
+		return;
+	}
+
+	for (i = 0; buf[i] != '\0'; i++)
+	{
+		*v->texthash ^= (unsigned char)buf[i];
+		*v->texthash *= 16777619u;
+	}
+	for (i = 0; i < (int)(sizeof fields / sizeof fields[0]); i++)
+	{
+		*v->texthash ^= fields[i];
+		*v->texthash *= 16777619u;
+	}
+}
+
+/* Write the label of a time marker into buf, which holds MARKER_LEN. */
+#define MARKER_LEN 20
+static const char *makemarker(char *buf, double timepos, double interval)
+{
+	int decimals;
+	double n;
+
+	/*
+	 * Count the number of decimals in this interval value:
+	 * 1.0    : 0
+	 * 0.1    : 1
+	 * 0.01   : 2
+	 * 0.001  : 3
+	 * 0.0001 : 4, etc.
+	 */
+	for (n = interval, decimals = 0; n < 1.0; n *= 10, decimals++)
+		;
+
+	snprintf(buf, MARKER_LEN, "%.*f", decimals, timepos);
+	return buf;
+}
+
+static void drawtimemarkers(view_t *v, int top, int left, int width,
+	int start, int num, int rate)
+{
+	double totaltime;
+	double markerinterval = 1000.0;
+	double secsperpixel;
+	double t;
+	double startsecs, endsecs; /* start and end of visible part, in secs */
+	char buf[MARKER_LEN];
+
+	totaltime = (double)num / rate; /* time in seconds */
+	secsperpixel = totaltime / width;
+	startsecs = (double)start / rate;
+	endsecs = (double)(start + num) / rate;
+
+	/*
+	 * Divide markerinterval by 10 as long as there's still room
+	 * for each marker without overlapping the next, or getting too close.
+	 */
+	while ((1+strlen(makemarker(buf, endsecs, markerinterval/10)))
+		* FONTWIDTH < markerinterval/10/secsperpixel)
+	{
+		markerinterval /= 10;
+	}
+
+	/* Find the first marker interval, where it should be. */
+	t = (double)start / rate;
+	if (fmod(t, markerinterval) > DBL_EPSILON)
+		t += markerinterval - fmod(t, markerinterval);
+	for (; t < endsecs; t += markerinterval)
+	{
+		int x = (int)((t - startsecs)/secsperpixel) + left;
+		vline(v->buffer, x, top - FONTHEIGHT/4, top + 3*FONTHEIGHT/4,
+			MARKER_FG);
+		drawtext(v, x + 2, top, MARKER_TEXT, -1, "%s",
+			makemarker(buf, t, markerinterval));
+	}
+}
+
+/* Convert a level relative to full scale to dB. */
+static double todb(double level)
+{
+	return level > 0.0 ? 20.0 * log10(level) : -INFINITY;
+}
+
+/*
+ * Write statistics about the selection in one channel of a track, on
+ * the line ending at bottom. They come straight from the summaries,
+ * so even an hour-long selection costs a few dozen nodes.
+ */
+static void drawstats(view_t *v, track_t *t, int chan, int left, int bottom,
+	bool withduration)
+{
+	const int num = MIN(v->selend, t->numsamples) - v->selstart;
+	int min, max, clips;
+	double peakdb, rmsdb, truepeak = -1.0;
+	char crest[20], tp[40] = "";
+
+	if (num <= 0)
+		return;
+
+	getminmax(t, chan, v->selstart, num, &min, &max);
+	clips = calcclips(t, chan, v->selstart, num);
+	peakdb = todb(MAX(abs(min), abs(max)) / SAMP_DIV_FLOAT);
+	rmsdb = todb(sqrt(calcsos(t, chan, v->selstart, num) / num));
+
+	if (isinf(rmsdb))
+		snprintf(crest, sizeof crest, "-");
+	else
+		snprintf(crest, sizeof crest, "%.1f dB", peakdb - rmsdb);
+	if (v->tpdisp && chan <= CHAN_RIGHT)
+		truepeak = calctruepeak(t, chan, v->selstart, num);
+	if (truepeak >= 0.0)
+	{
+		snprintf(tp, sizeof tp, "  true peak %.1f dBTP",
+			todb(truepeak / SAMP_DIV_FLOAT));
+	}
+
+	drawtext(v, left + 2, bottom - FONTHEIGHT - 2, STATS_TEXT, CHANNEL_BG,
+		"peak %.1f dB  RMS %.1f dB  crest %s  clips %d%s",
+		peakdb, rmsdb, crest, clips, tp);
+	if (withduration)
+	{
+		drawtext(v, left + 2, bottom - 2*FONTHEIGHT - 4, STATS_TEXT,
+			CHANNEL_BG, "selected %.3f s", (double)num / t->samprate);
+	}
+}
+
+/*
+ * Draw a histogram of the levels of one channel of a track, from the
+ * summaries, in a box at the top right of its lane: loud on the right,
+ * quiet on the left, in HIST_STEP_DB steps. Under it goes the level
+ * half the samples are above, which sits close to the peak in music
+ * that's squashed flat.
+ */
+static void drawhistogram(view_t *v, track_t *t, int chan, int top,
+	int height, int right)
+{
+	const int boxw = HIST_BINS * HIST_BAR_WIDTH + 4;
+	const int boxh = HIST_BAR_HEIGHT + 2*FONTHEIGHT + 8;
+	const int x0 = right - boxw - 4, y0 = top + 4;
+	const int base = y0 + FONTHEIGHT + 4 + HIST_BAR_HEIGHT;
+	int32_t hist[HIST_BINS];
+	int start, num, bin, half;
+	long total = 0, most = 0, above = 0;
+
+	if (height < boxh + 8 || x0 < 0)
+		return;
+
+	if (v->histdisp == HIST_WHOLE)
+		start = 0, num = t->numsamples;
+	else
+		start = v->pos, num = (int)(v->zoom * v->width);
+	calchist(t, chan, start, num, hist);
+	for (bin = 0; bin < HIST_BINS; bin++)
+	{
+		total += hist[bin];
+		most = MAX(most, hist[bin]);
+	}
+	if (total == 0)
+		return;
+
+	rectfill(v->buffer, x0, y0, x0 + boxw - 1, y0 + boxh - 1, CHANNEL_BG);
+	rect(v->buffer, x0, y0, x0 + boxw - 1, y0 + boxh - 1, HIST_BORDER);
+	drawtext(v, x0 + 2, y0 + 2, STATS_TEXT, -1, "%s",
+		v->histdisp == HIST_WHOLE ? "whole file" : "visible");
+
+	for (bin = 0; bin < HIST_BINS; bin++)
+	{
+		const int x = x0 + 2 + (HIST_BINS-1 - bin) * HIST_BAR_WIDTH;
+		const int h = (int)((hist[bin] * (long)HIST_BAR_HEIGHT
+			+ most - 1) / most);
+		const int color = bin == HIST_BINS - 1 ? HIST_REST_COLOR
+			: HIST_COLOR;
+
+		if (h > 0)
+		{
+			rectfill(v->buffer, x + 1, base - h,
+				x + HIST_BAR_WIDTH - 2, base - 1, color);
+		}
+	}
+
+	for (half = 0; above + hist[half] < (total + 1) / 2; half++)
+		above += hist[half];
+	if (half < HIST_BINS - 1)
+	{
+		drawtext(v, x0 + 2, base + 2, STATS_TEXT, -1,
+			"half > -%d dB", (half + 1) * HIST_STEP_DB);
+	}
+	else
+	{
+		drawtext(v, x0 + 2, base + 2, STATS_TEXT, -1,
+			"half < -%d dB", half * HIST_STEP_DB);
+	}
+}
+
+/*
+ * Draw one track: its two channels, time markers and, if enabled,
+ * correlation and selection statistics, in the given slice of the
+ * screen.
+ */
+static void drawtrack(view_t *v, track_t *t, const column_t *row,
+	int top, int height)
+{
+	int ch;
+
+	/* Height of the two channel lanes, leaving room for correlation. */
+	const int laneheight = v->corrdisp ? height - height/CORR_FRACTION
+		: height;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		drawchannel(v, top + ch * laneheight/2,
+			laneheight/2 - FONTHEIGHT, 0, v->width, row, ch,
+			skiprms(v, t));
+		drawtimemarkers(v, top + (ch+1) * laneheight/2 - FONTHEIGHT, 0,
+			v->width, v->pos, (int)(v->zoom*v->width), t->samprate);
+		if (v->hassel)
+		{
+			drawstats(v, t, v->msdisp ? CHAN_MID + ch : ch, 0,
+				top + (ch+1) * laneheight/2 - FONTHEIGHT,
+				ch == 0);
+		}
+		if (v->histdisp != HIST_OFF)
+		{
+			drawhistogram(v, t, v->msdisp ? CHAN_MID + ch : ch,
+				top + ch * laneheight/2,
+				laneheight/2 - FONTHEIGHT, v->width);
+		}
+	}
+	if (v->corrdisp)
+	{
+		drawcorrelation(v, top + laneheight,
+			height - laneheight - FONTHEIGHT, 0, v->width, row);
+	}
+
+	if (v->ntracks > 1)
+	{
+		drawtext(v, 2, top + 2, MARKER_TEXT, -1, "%s", t->name);
+	}
+}
+
+// Draw everything into the view's buffer.
+void render(view_t *v)
+{
+	const int chunks = (v->width + COLUMN_CHUNK - 1) / COLUMN_CHUNK;
+	int i;
+
+	/* Every lane's summaries are worked out in parallel. */
+	if (v->parallel)
+		pool_for(computecolumns, v, v->ntracks * chunks);
+	else
+	{
+		for (i = 0; i < v->ntracks * chunks; i++)
+			computecolumns(v, i);
+	}
+
+	clear_to_color(v->buffer, SCREEN_BG);
+
+	for (i = 0; i < v->ntracks; i++)
+	{
+		drawtrack(v, v->tracks[i], &v->columns[i * v->width],
+			i * v->height / v->ntracks, v->height / v->ntracks);
+	}
+}
+
+/*
+ * Set up a view of the given tracks, drawn into buffer, with the
+ * default display options: the start of the tracks, one sample per
+ * pixel, linear peaks.
+ */
+void view_init(view_t *v, BITMAP *buffer, track_t **tracks, int ntracks)
+{
+	int i;
+
+	memset(v, 0, sizeof *v);
+	v->buffer = buffer;
+	v->width = buffer->w;
+	v->height = buffer->h;
+	v->tracks = tracks;
+	v->ntracks = ntracks;
+	for (i = 0; i < ntracks; i++)
+		v->numsamples = MAX(v->numsamples, tracks[i]->numsamples);
+	v->zoom = 1.0;
+	v->peakdisp = 1;
+	v->columns = xm(sizeof *v->columns, ntracks * v->width);
+}
+
+/*
+ * Keep the columns of recent renders, for a view that moves back and
+ * forth over the same tracks, like the one on screen. Not worth it for
+ * a view that's drawn once.
+ */
+void view_cachecolumns(view_t *v)
+{
+	if (v->cache != NULL)
+		return;
+	v->cache = xm(sizeof *v->cache, 1);
+	pthread_mutex_init(&v->cache->lock, NULL);
+	memset(v->cache->ent, 0, sizeof v->cache->ent);
+}
+
+// Free what view_init() allocated. The buffer and tracks are the caller's.
+void view_free(view_t *v)
+{
+	free(v->columns);
+	v->columns = NULL;
+	if (v->cache != NULL)
+	{
+		pthread_mutex_destroy(&v->cache->lock);
+		free(v->cache);
+		v->cache = NULL;
+	}
+}
@@ -0,0 +1,63 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FONTHEIGHT 8
+#define FONTWIDTH 8
+
+#define VZOOM_MIN 0
+#define VZOOM_MAX 15
+
+/* Ranges the level histogram can show. */
+enum { HIST_OFF = 0, HIST_VISIBLE, HIST_WHOLE };
+
+/* Summary results for one pixel column of one track. */
+typedef struct
+{
+	int min[2], max[2]; // Peaks of the two displayed channels.
+	int rms[2]; // RMS of the two displayed channels, as a sample value.
+	float truepeak[2]; // Their true peaks, or -1 if not known yet.
+	double corr; // Left/right correlation.
+	bool hascorr; // False past the end of the track.
+} column_t;
+
+/*
+ * What to draw and how: the tracks, which part of them, and the display
+ * options. Everything render() needs is in here, so several views can
+ * be drawn at once by different threads.
+ */
+typedef struct
+{
+	BITMAP *buffer; // Drawn into; width by height.
+	int width, height;
+	track_t **tracks; // The files being compared, top to bottom.
+	int ntracks;
+	int numsamples; // Samples per channel in the longest track.
+	double zoom; /* Number of samples in each pixel. */
+	int vzoom; /* Amplitude shown as 2^this times real amplitude. */
+	int pos; /* Sample value at leftmost pixel. */
+	int logdisp; /* Use logarithmic display? */
+	int peakdisp; /* Show peaks? */
+	int rmsdisp; /* Show RMS averages? */
+	int msdisp; /* Show mid/side instead of left/right? */
+	int corrdisp; /* Show left/right correlation? */
+	int tpdisp; /* Show true peaks (of left and right only)? */
+	int histdisp; /* Level histogram of what? One of the HIST_ enums. */
+	bool hassel; /* Is there a selection? */
+	int selstart, selend; /* Selected samples, selstart..selend-1. */
+	bool parallel; // Work out the columns on the worker pool?
+	column_t *columns; // ntracks rows of width columns.
+	struct colcache *cache; // Recent columns, if view_cachecolumns().
+	uint32_t *texthash; // If set, text is hashed into this, not drawn.
+
+	/* Where the last column drawn ended, to join the next one on. */
+	int lastpeaky1, lastpeaky2;
+	int lastrmsy1, lastrmsy2;
+	int lasttpy1, lasttpy2;
+	int chan_i;
+} view_t;
+
+void view_init(view_t *v, BITMAP *buffer, track_t **tracks, int ntracks);
+void view_cachecolumns(view_t *v);
+void view_free(view_t *v);
+int colsample(const view_t *v, int x);
+void render(view_t *v);
@@ -0,0 +1,777 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <allegro.h>
+#include "xm.h"
+#include "errquit.h"
+#include "pool.h"
+#include "track.h"
+#include "pack.h"
+#include "synth.h"
+#include "load.h"
+#include "render.h"
+#include "serve.h"
+
+/*
+ * Tile server: keeps files and their summaries loaded between requests,
+ * and answers requests for pieces of their waveforms over a Unix domain
+ * socket, for dashboards and the like. One request per line:
+ *
+ *   tile POS ZOOM WIDTH HEIGHT OPTIONS FILE
+ *   cols POS ZOOM WIDTH HEIGHT OPTIONS FILE
+ *   stats
+ *
+ * POS is the first sample, ZOOM samples per pixel column. OPTIONS is "-"
+ * for the default view (linear peaks), or a comma separated list of
+ * peak, rms, log, midside, corr and vzoom=N. FILE is the rest of the
+ * line. A tile comes back as a binary PPM image; cols as little-endian
+ * 16-bit arrays of the per-column min, max and RMS of the first
+ * displayed channel, then of the second (HEIGHT is ignored). stats gives
+ * the latency counters as text.
+ *
+ * Each answer is "ok BYTES\n" followed by that many bytes, or
+ * "error MESSAGE\n".
+ */
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+#define SERVE_MAXLINE 4096
+#define SERVE_MAXDIM 8192 // Largest tile width or height.
+#define SERVE_BACKLOG 64
+
+/* A file that's loaded, or being loaded. */
+typedef struct entry
+{
+	char *name;
+	track_t *track; // NULL while it's being loaded.
+	time_t mtime; // Of the file when it was loaded, to notice changes.
+	off_t size;
+	int users; // Requests using it right now.
+	unsigned long lastused; // Value of usecount when last asked for.
+	bool detached; // Taken out of the cache, but still in use.
+	struct entry *next;
+} entry_t;
+
+/* The cache of loaded files, most recently loaded first. */
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER;
+static entry_t *cache = NULL;
+static unsigned long usecount = 0;
+static size_t budget;
+static bool rawfiles;
+static bool packfiles;
+static int rawrate;
+
+/* Latency counters, for each kind of request. */
+enum { REQ_TILE, REQ_COLS, REQ_STATS, REQ_OTHER, NUMREQS };
+static const char *const reqnames[NUMREQS] = { "tile", "cols", "stats",
+	"other" };
+static const double bucketms[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500,
+	1000 };
+#define NUMBUCKETS (sizeof bucketms / sizeof bucketms[0] + 1)
+static struct
+{
+	unsigned long count, errors;
+	double totalms, maxms;
+	unsigned long buckets[NUMBUCKETS]; // The last is for the rest.
+} reqstats[NUMREQS];
+static unsigned long hits, loads, evictions;
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A client's connection, and what it's sent of its next request. */
+typedef struct
+{
+	int fd;
+	FILE *out;
+	char buf[SERVE_MAXLINE];
+	int len;
+} conn_t;
+
+/*
+ * Connections with something to read, waiting for a thread to answer
+ * them, and connections answered, waiting for the main thread to poll
+ * them again. A byte down the wake pipe tells it there are some.
+ */
+static pthread_mutex_t queuelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static conn_t **queue = NULL;
+static int nqueue = 0, squeue = 0;
+static conn_t **answered = NULL;
+static int nanswered = 0, sanswered = 0;
+static int wakepipe[2];
+
+static double nowms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Free an entry that's out of the cache and no longer in use.
+static void freeentry(entry_t *e)
+{
+	track_release(e->track);
+	free(e->name);
+	free(e);
+}
+
+// Take an entry out of the cache. Call with cachelock held.
+static void detach(entry_t *e)
+{
+	entry_t **pe;
+
+	for (pe = &cache; *pe != e; pe = &(*pe)->next)
+		;
+	*pe = e->next;
+	e->detached = true;
+	if (e->users == 0)
+		freeentry(e);
+}
+
+/*
+ * Evict the least recently used files nobody is using until the memory
+ * budget is met, or there's nothing left to evict. Call with cachelock
+ * held.
+ */
+static void evict(void)
+{
+	while (track_memused() > budget)
+	{
+		entry_t *e, *lru = NULL;
+
+		for (e = cache; e != NULL; e = e->next)
+		{
+			if (e->users == 0 && e->track != NULL
+				&& (lru == NULL || e->lastused < lru->lastused))
+			{
+				lru = e;
+			}
+		}
+		if (lru == NULL)
+			return;
+		detach(lru);
+		pthread_mutex_lock(&statslock);
+		evictions++;
+		pthread_mutex_unlock(&statslock);
+	}
+}
+
+/*
+ * Load a file, catching any error. Returns NULL, with the message in
+ * err, if it can't be loaded.
+ */
+static track_t *tryload(const char *name, char *err, size_t errlen)
+{
+	errcatch_t catch;
+	FILE *volatile fp = NULL;
+	track_t *t;
+
+	if (setjmp(catch.env) != 0)
+	{
+		errcatch = NULL;
+		if (fp != NULL)
+			fclose(fp);
+		snprintf(err, errlen, "%s", catch.msg);
+		return NULL;
+	}
+	errcatch = &catch;
+
+	if (issynth(name))
+		t = synth(name, rawrate);
+	else
+	{
+		if ((fp = fopen(name, "rb")) == NULL)
+			errquit("cannot open %s", name);
+		t = loadtrack(name, fp, rawfiles, rawrate); // Closes fp.
+	}
+	if (packfiles)
+		track_pack(t);
+
+	errcatch = NULL;
+	return t;
+}
+
+/*
+ * Get the cache entry for a file, loading it if it isn't loaded or has
+ * changed since. Returns NULL, with the message in err, if it can't be
+ * loaded. Give the entry back with putentry().
+ */
+static entry_t *getentry(const char *name, char *err, size_t errlen)
+{
+	struct stat st;
+	entry_t *e;
+	track_t *t;
+
+	memset(&st, 0, sizeof st);
+	if (!issynth(name) && stat(name, &st) != 0)
+	{
+		snprintf(err, errlen, "cannot open %s: %s", name,
+			strerror(errno));
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cachelock);
+	for (;;)
+	{
+		for (e = cache; e != NULL; e = e->next)
+		{
+			if (strcmp(e->name, name) == 0)
+				break;
+		}
+		if (e != NULL && e->track == NULL)
+		{
+			// Someone else is loading it.
+			pthread_cond_wait(&loaded, &cachelock);
+			continue;
+		}
+		if (e != NULL && (e->mtime != st.st_mtime
+			|| e->size != st.st_size))
+		{
+			detach(e);
+			e = NULL;
+		}
+		break;
+	}
+
+	if (e != NULL)
+	{
+		e->users++;
+		e->lastused = ++usecount;
+		pthread_mutex_unlock(&cachelock);
+		pthread_mutex_lock(&statslock);
+		hits++;
+		pthread_mutex_unlock(&statslock);
+		return e;
+	}
+
+	e = xm(sizeof *e, 1);
+	e->name = xm(1, strlen(name) + 1);
+	strcpy(e->name, name);
+	e->track = NULL;
+	e->mtime = st.st_mtime;
+	e->size = st.st_size;
+	e->users = 1;
+	e->lastused = ++usecount;
+	e->detached = false;
+	e->next = cache;
+	cache = e;
+	pthread_mutex_unlock(&cachelock);
+
+	t = tryload(e->name, err, errlen);
+
+	pthread_mutex_lock(&cachelock);
+	if (t == NULL)
+	{
+		entry_t **pe;
+
+		for (pe = &cache; *pe != e; pe = &(*pe)->next)
+			;
+		*pe = e->next;
+		free(e->name);
+		free(e);
+		e = NULL;
+	}
+	else
+	{
+		e->track = t;
+		evict();
+	}
+	pthread_cond_broadcast(&loaded);
+	pthread_mutex_unlock(&cachelock);
+
+	if (e != NULL)
+	{
+		pthread_mutex_lock(&statslock);
+		loads++;
+		pthread_mutex_unlock(&statslock);
+	}
+	return e;
+}
+
+// Done with an entry from getentry().
+static void putentry(entry_t *e)
+{
+	pthread_mutex_lock(&cachelock);
+	if (--e->users == 0 && e->detached)
+		freeentry(e);
+	else
+		evict();
+	pthread_mutex_unlock(&cachelock);
+}
+
+/*
+ * Set up the display options of a view from a request's OPTIONS.
+ * Returns false if there's one it doesn't know.
+ */
+static bool parseoptions(view_t *v, char *opts)
+{
+	char *opt, *save;
+
+	if (strcmp(opts, "-") == 0)
+		return true;
+
+	v->peakdisp = 0;
+	for (opt = strtok_r(opts, ",", &save); opt != NULL;
+		opt = strtok_r(NULL, ",", &save))
+	{
+		if (strcmp(opt, "peak") == 0)
+			v->peakdisp = 1;
+		else if (strcmp(opt, "rms") == 0)
+			v->rmsdisp = 1;
+		else if (strcmp(opt, "log") == 0)
+			v->logdisp = 1;
+		else if (strcmp(opt, "midside") == 0)
+			v->msdisp = 1;
+		else if (strcmp(opt, "corr") == 0)
+			v->corrdisp = 1;
+		else if (strncmp(opt, "vzoom=", 6) == 0)
+		{
+			v->vzoom = atoi(opt + 6);
+			if (v->vzoom < VZOOM_MIN || v->vzoom > VZOOM_MAX)
+				return false;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+// Store a sample value as 16 bits, little-endian.
+static void putle16(unsigned char *p, int val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+}
+
+// Send an answer: its length, then its bytes.
+static void reply(FILE *out, const void *data, size_t len)
+{
+	fprintf(out, "ok %lu\n", (unsigned long)len);
+	fwrite(data, 1, len, out);
+}
+
+// Draw a tile and send it as a PPM image.
+static void sendtile(FILE *out, view_t *v)
+{
+	const int headlen = snprintf(NULL, 0, "P6\n%d %d\n255\n",
+		v->width, v->height);
+	const size_t len = headlen + (size_t)v->width * v->height * 3;
+	unsigned char *ppm = xm(1, len + 1);
+	unsigned char *p = ppm + headlen;
+	int x, y;
+
+	render(v);
+
+	sprintf((char *)ppm, "P6\n%d %d\n255\n", v->width, v->height);
+	for (y = 0; y < v->height; y++)
+	{
+		for (x = 0; x < v->width; x++)
+		{
+			const int c = getpixel(v->buffer, x, y);
+
+			*p++ = getr(c);
+			*p++ = getg(c);
+			*p++ = getb(c);
+		}
+	}
+	reply(out, ppm, len);
+	free(ppm);
+}
+
+// Work out the columns of a view's track and send them as arrays.
+static void sendcols(FILE *out, const view_t *v)
+{
+	track_t *const t = v->tracks[0];
+	const int firstchan = v->msdisp ? CHAN_MID : CHAN_LEFT;
+	const size_t len = (size_t)v->width * 2 * 3 * 2;
+	unsigned char *data = xm(1, len);
+	int x, ch;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		unsigned char *const mins = &data[(size_t)ch * 3*2 * v->width];
+		unsigned char *const maxes = mins + 2 * v->width;
+		unsigned char *const rmses = maxes + 2 * v->width;
+
+		for (x = 0; x < v->width; x++)
+		{
+			const int start = colsample(v, x);
+			const int num = colsample(v, x + 1) - start;
+			int min, max, rms;
+
+			getminmax(t, firstchan + ch, start, num, &min, &max);
+			rms = (int)(SAMP_DIV_FLOAT
+				* calcrms(t, firstchan + ch, start, num));
+			putle16(&mins[2*x], min);
+			putle16(&maxes[2*x], max);
+			putle16(&rmses[2*x], MIN(rms, MAXSAMP));
+		}
+	}
+	reply(out, data, len);
+	free(data);
+}
+
+// Send the latency counters, and how the cache is doing.
+static void sendstats(FILE *out)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&text, &len);
+	int cached = 0;
+	entry_t *e;
+	unsigned i, j;
+
+	pthread_mutex_lock(&cachelock);
+	for (e = cache; e != NULL; e = e->next)
+		cached++;
+	pthread_mutex_unlock(&cachelock);
+
+	pthread_mutex_lock(&statslock);
+	for (i = 0; i < NUMREQS; i++)
+	{
+		fprintf(fp, "%s requests %lu errors %lu mean %.3f ms "
+			"max %.3f ms\n%s latency", reqnames[i],
+			reqstats[i].count, reqstats[i].errors, reqstats[i].count == 0 ? 0.0
+			: reqstats[i].totalms / reqstats[i].count,
+			reqstats[i].maxms, reqnames[i]);
+		for (j = 0; j < NUMBUCKETS; j++)
+		{
+			if (j < NUMBUCKETS - 1)
+				fprintf(fp, " <%gms", bucketms[j]);
+			else
+				fprintf(fp, " more");
+			fprintf(fp, " %lu", reqstats[i].buckets[j]);
+		}
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "cache files %d hits %lu loads %lu evictions %lu "
+		"memory %lu of %lu MB\n", cached, hits, loads, evictions,
+		(unsigned long)(track_memused() >> 20),
+		(unsigned long)(budget >> 20));
+	pthread_mutex_unlock(&statslock);
+
+	fclose(fp);
+	reply(out, text, len);
+	free(text);
+}
+
+// Count a request that took ms.
+static void countrequest(int req, bool failed, double ms)
+{
+	unsigned j;
+
+	for (j = 0; j < NUMBUCKETS - 1 && ms >= bucketms[j]; j++)
+		;
+	pthread_mutex_lock(&statslock);
+	reqstats[req].count++;
+	reqstats[req].errors += failed;
+	reqstats[req].totalms += ms;
+	reqstats[req].maxms = MAX(reqstats[req].maxms, ms);
+	reqstats[req].buckets[j]++;
+	pthread_mutex_unlock(&statslock);
+}
+
+/*
+ * Answer one request line. Returns false, having sent an error, if it
+ * couldn't be answered.
+ */
+static bool request(FILE *out, char *line, int *preq)
+{
+	char verb[16], opts[256];
+	char err[1100];
+	int pos, width, height, n = 0;
+	double zoom;
+	const char *name;
+	entry_t *e;
+	BITMAP *buffer;
+	view_t v;
+	bool ok = true;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	*preq = REQ_OTHER;
+	if (strcmp(line, "stats") == 0)
+	{
+		*preq = REQ_STATS;
+		sendstats(out);
+		return true;
+	}
+
+	if (sscanf(line, "%15s %d %lf %d %d %255s %n", verb, &pos, &zoom,
+		&width, &height, opts, &n) != 6 || n == 0 || line[n] == '\0'
+		|| (strcmp(verb, "tile") != 0 && strcmp(verb, "cols") != 0))
+	{
+		fprintf(out, "error bad request\n");
+		return false;
+	}
+	*preq = strcmp(verb, "tile") == 0 ? REQ_TILE : REQ_COLS;
+	name = &line[n];
+
+	/*
+	 * The columns run to sample pos + width*zoom, which has to fit in
+	 * an int. (Written so a NaN zoom fails too.)
+	 */
+	if (pos < 0 || !(zoom >= 1.0) || width < 1 || width > SERVE_MAXDIM
+		|| pos + (double)width * zoom > INT_MAX
+		|| (*preq == REQ_TILE && (height < 4 * FONTHEIGHT
+		|| height > SERVE_MAXDIM)))
+	{
+		fprintf(out, "error bad position, zoom or size\n");
+		return false;
+	}
+
+	if ((e = getentry(name, err, sizeof err)) == NULL)
+	{
+		fprintf(out, "error %s\n", err);
+		return false;
+	}
+
+	buffer = create_bitmap(width, *preq == REQ_TILE ? height : 1);
+	if (buffer == NULL)
+	{
+		fprintf(out, "error out of memory\n");
+		putentry(e);
+		return false;
+	}
+	view_init(&v, buffer, &e->track, 1);
+	v.pos = pos;
+	v.zoom = zoom;
+	if (!parseoptions(&v, opts))
+	{
+		fprintf(out, "error bad options\n");
+		ok = false;
+	}
+	else if (*preq == REQ_TILE)
+		sendtile(out, &v);
+	else
+		sendcols(out, &v);
+	view_free(&v);
+	destroy_bitmap(buffer);
+	putentry(e);
+	return ok;
+}
+
+/*
+ * Read what a connection has sent, and answer each whole request line
+ * in it. Returns false if it's been closed, or should be. A thread only
+ * ever waits for a connection to take an answer, never for a request.
+ */
+static bool serveconn(conn_t *c)
+{
+	char line[SERVE_MAXLINE];
+	const ssize_t got = read(c->fd, c->buf + c->len,
+		sizeof c->buf - 1 - c->len);
+
+	if (got < 0 && errno == EINTR)
+		return true;
+	if (got > 0)
+		c->len += (int)got;
+
+	for (;;)
+	{
+		const char *const nl = memchr(c->buf, '\n', c->len);
+		const int linelen = nl != NULL ? (int)(nl - c->buf) + 1
+			: c->len;
+		const double start = nowms();
+		int req;
+		bool ok;
+
+		// Wait for the rest of a line, unless there's no more room.
+		if (nl == NULL && got > 0 && c->len < (int)sizeof c->buf - 1)
+			return true;
+		if (linelen == 0)
+			return false; // Hung up, with nothing left to answer.
+
+		memcpy(line, c->buf, linelen);
+		line[linelen] = '\0';
+		c->len -= linelen;
+		memmove(c->buf, c->buf + linelen, c->len);
+
+		ok = request(c->out, line, &req);
+		if (fflush(c->out) != 0)
+			return false;
+		countrequest(req, !ok, nowms() - start);
+	}
+}
+
+static void *servethread(void *unused)
+{
+	(void)unused;
+	for (;;)
+	{
+		conn_t *c;
+
+		pthread_mutex_lock(&queuelock);
+		while (nqueue == 0)
+			pthread_cond_wait(&queued, &queuelock);
+		c = queue[0];
+		memmove(queue, queue + 1, --nqueue * sizeof *queue);
+		pthread_mutex_unlock(&queuelock);
+
+		if (!serveconn(c))
+		{
+			fclose(c->out);
+			close(c->fd);
+			free(c);
+			continue;
+		}
+
+		// Hand it back to be polled for its next request.
+		pthread_mutex_lock(&queuelock);
+		XPND(answered, nanswered, sanswered);
+		answered[nanswered++] = c;
+		pthread_mutex_unlock(&queuelock);
+		// A full pipe means the main thread is due to wake anyway.
+		while (write(wakepipe[1], "", 1) < 0 && errno == EINTR)
+			;
+	}
+	return NULL;
+}
+
+/*
+ * Listen on a Unix domain socket, answering requests on a pool of
+ * threads, forever. The main thread polls the connections between
+ * requests, so idle clients don't hold on to threads. Files stay loaded until they take the memory used
+ * over membudget, when the least recently used go. Raw files are taken
+ * to be at samprate. If pack, samples are kept packed (see pack.c).
+ */
+void serve(const char *sockpath, size_t membudget, bool forceraw,
+	bool pack, int samprate)
+{
+	const int nthreads = MAX(4, 2 * pool_numcpus());
+	struct sockaddr_un addr;
+	struct stat st;
+	pthread_t thread;
+	struct pollfd *fds = NULL;
+	conn_t **polled = NULL;
+	int npolled = 0, spolled = 0;
+	int sock, i;
+	char junk[64];
+
+	budget = membudget;
+	rawfiles = forceraw;
+	packfiles = pack;
+	rawrate = samprate;
+
+	/* Colors of the tiles come from the default palette. */
+	set_color_depth(8);
+	select_palette(default_palette);
+	makecol(0, 0, 0); // Sets up Allegro's color lookup up front.
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof addr.sun_path)
+		errquit("socket path too long: %s", sockpath);
+	strcpy(addr.sun_path, sockpath);
+
+	// A socket left behind by an earlier server is in the way.
+	if (stat(sockpath, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(sockpath);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		|| bind(sock, (struct sockaddr *)&addr, sizeof addr) != 0
+		|| listen(sock, SERVE_BACKLOG) != 0)
+	{
+		errquit("cannot listen on %s: %s", sockpath, strerror(errno));
+	}
+
+	if (pipe(wakepipe) != 0
+		|| fcntl(wakepipe[0], F_SETFL, O_NONBLOCK) != 0
+		|| fcntl(wakepipe[1], F_SETFL, O_NONBLOCK) != 0)
+	{
+		errquit("cannot make a pipe: %s", strerror(errno));
+	}
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&thread, NULL, servethread, NULL) != 0)
+			errquit("cannot start server threads");
+		pthread_detach(thread);
+	}
+
+	for (;;)
+	{
+		// Take back the connections that have been answered.
+		pthread_mutex_lock(&queuelock);
+		while (nanswered > 0)
+		{
+			XPND(polled, npolled, spolled);
+			polled[npolled++] = answered[--nanswered];
+		}
+		pthread_mutex_unlock(&queuelock);
+
+		fds = xr(fds, sizeof *fds, npolled + 2);
+		fds[0].fd = sock;
+		fds[1].fd = wakepipe[0];
+		for (i = 0; i < npolled; i++)
+			fds[i + 2].fd = polled[i]->fd;
+		for (i = 0; i < npolled + 2; i++)
+			fds[i].events = POLLIN;
+		if (poll(fds, npolled + 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			errquit("poll failed: %s", strerror(errno));
+		}
+
+		if (fds[1].revents != 0)
+			while (read(wakepipe[0], junk, sizeof junk) > 0)
+				;
+
+		// Queue the connections with something to read (or a hangup).
+		for (i = npolled - 1; i >= 0; i--)
+		{
+			if (fds[i + 2].revents == 0)
+				continue;
+			pthread_mutex_lock(&queuelock);
+			XPND(queue, nqueue, squeue);
+			queue[nqueue++] = polled[i];
+			pthread_cond_signal(&queued);
+			pthread_mutex_unlock(&queuelock);
+			polled[i] = polled[--npolled];
+		}
+
+		if (fds[0].revents != 0)
+		{
+			const int fd = accept(sock, NULL, NULL);
+			conn_t *c;
+
+			if (fd < 0)
+			{
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				errquit("accept failed: %s", strerror(errno));
+			}
+			c = xm(sizeof *c, 1);
+			c->fd = fd;
+			c->len = 0;
+			if ((c->out = fdopen(dup(fd), "w")) == NULL)
+			{
+				close(fd);
+				free(c);
+				continue;
+			}
+			XPND(polled, npolled, spolled);
+			polled[npolled++] = c;
+		}
+	}
+}
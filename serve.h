@@ -0,0 +1,5 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+void serve(const char *sockpath, size_t membudget, bool forceraw,
+	bool pack, int samprate);
@@ -0,0 +1,153 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xm.h"
+#include "errquit.h"
+#include "track.h"
+#include "synth.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Synthetic test signals, named like "synth:sweep" or "synth:sweep:600"
+ * (the number is a length in seconds). They're the same every time, so
+ * renders of them can be compared from one build to the next.
+ */
+
+#define SYNTH_PREFIX "synth:"
+#define DEF_SYNTH_SECS 60
+
+// White noise from -1 to 1, as a hash of the sample number, so signals
+// don't depend on the C library's random numbers.
+static double noise(uint32_t i)
+{
+	i ^= i >> 16;
+	i *= 0x7feb352dU;
+	i ^= i >> 15;
+	i *= 0x846ca68bU;
+	i ^= i >> 16;
+	return (double)(i >> 8) / (1u << 23) - 1.0;
+}
+
+static int16_t tosamp(double f)
+{
+	if (f >= 1.0)
+		return MAXSAMP;
+	if (f <= -1.0)
+		return MINSAMP;
+	return (int16_t)lrint(f * MAXSAMP);
+}
+
+/* Fill in frame i of n of each kind of signal. */
+
+static void sine(int i, int n, int rate, double *l, double *r)
+{
+	(void)n;
+	*l = 0.5 * sin(2 * M_PI * 1000.0 * i / rate);
+	*r = 0.5 * sin(2 * M_PI * 1500.0 * i / rate);
+}
+
+// Log sweep from 20 Hz to 20 kHz with a fade in and out.
+static void sweep(int i, int n, int rate, double *l, double *r)
+{
+	const double t = (double)i / rate, len = (double)n / rate;
+	const double k = log(1000.0);
+	const double phase = 2 * M_PI * 20.0 * len / k * (exp(k * t / len) - 1);
+
+	*l = *r = 0.8 * sin(M_PI * i / n) * sin(phase);
+}
+
+// Noise with slow swells, roughly shaped like program material.
+static void swells(int i, int n, int rate, double *l, double *r)
+{
+	const double env = 0.05 + 0.6 * pow(sin(M_PI * i / rate / 7.3), 2)
+		* (0.6 + 0.4 * sin(2 * M_PI * i / rate / 0.5));
+
+	(void)n;
+	*l = env * noise(2*i);
+	*r = 0.7 * *l + 0.3 * env * noise(2*i + 1);
+}
+
+// A sine driven hard into clipping every other second.
+static void clipped(int i, int n, int rate, double *l, double *r)
+{
+	const double gain = (i / rate) % 2 ? 4.0 : 0.9;
+
+	(void)n;
+	*l = gain * sin(2 * M_PI * 440.0 * i / rate);
+	*r = -*l;
+}
+
+// Silence with a full-scale impulse every 0.3 seconds.
+static void impulses(int i, int n, int rate, double *l, double *r)
+{
+	const int every = rate * 3 / 10;
+
+	(void)n;
+	*l = i % every == 0 ? 1.0 : i % every == 1 ? -0.5 : 0.0;
+	*r = i % every == every / 2 ? -1.0 : 0.0;
+}
+
+static const struct
+{
+	const char *kind;
+	void (*fn)(int i, int n, int rate, double *l, double *r);
+} kinds[] =
+{
+	{ "sine", sine },
+	{ "sweep", sweep },
+	{ "swells", swells },
+	{ "clipped", clipped },
+	{ "impulses", impulses },
+};
+
+bool issynth(const char *name)
+{
+	return strncmp(name, SYNTH_PREFIX, strlen(SYNTH_PREFIX)) == 0;
+}
+
+// Make a track of one of the synthetic signals, by name.
+track_t *synth(const char *name, int samprate)
+{
+	const char *kind = name + strlen(SYNTH_PREFIX);
+	const char *colon = strchr(kind, ':');
+	const size_t kindlen = colon ? (size_t)(colon - kind) : strlen(kind);
+	const double secs = colon ? atof(colon + 1) : DEF_SYNTH_SECS;
+	int16_t *samples;
+	track_t *t;
+	int k, i, n;
+
+	for (k = 0; k < (int)(sizeof kinds / sizeof kinds[0]); k++)
+	{
+		if (strlen(kinds[k].kind) == kindlen
+			&& strncmp(kinds[k].kind, kind, kindlen) == 0)
+		{
+			break;
+		}
+	}
+	if (k == (int)(sizeof kinds / sizeof kinds[0]))
+		errquit("unknown synthetic signal %s", name);
+	if (secs <= 0 || secs * samprate > INT32_MAX / 2)
+		errquit("bad length for %s", name);
+
+	n = (int)(secs * samprate);
+	track_charge((size_t)n * 2 * sizeof *samples, name);
+	samples = xm(2 * sizeof *samples, n);
+	for (i = 0; i < n; i++)
+	{
+		double l, r;
+
+		kinds[k].fn(i, n, samprate, &l, &r);
+		samples[i*2] = tosamp(l);
+		samples[i*2 + 1] = tosamp(r);
+	}
+
+	t = track_new(name, samples, n, samprate, NULL);
+	t->membytes += (size_t)n * 2 * sizeof *samples;
+	track_fillall(t);
+	return t;
+}
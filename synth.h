@@ -0,0 +1,4 @@
+#include <stdbool.h>
+
+bool issynth(const char *name);
+track_t *synth(const char *name, int samprate);
@@ -0,0 +1,1177 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "xm.h"
+#include "errquit.h"
+#include "pool.h"
+#include "track.h"
+#include "truepeak.h"
+#include "pack.h"
+
+#undef MIN
+#undef MAX
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/* Bitsets of node states, as in level_t. */
+#define WORDBITS (8 * sizeof (unsigned long))
+#define BITWORD(i) ((i) / WORDBITS)
+#define BITMASK(i) (1UL << (i) % WORDBITS)
+#define BITWORDS(n) (((n) + WORDBITS - 1) / WORDBITS)
+
+/* How many blocks a background worker fills in at a time. */
+#define FILL_CHUNK (SUMMARY_FANOUT * SUMMARY_FANOUT)
+
+/* Every loaded track, for the background workers. */
+static pthread_mutex_t trackslock = PTHREAD_MUTEX_INITIALIZER;
+static track_t **tracks = NULL;
+static int ntracks = 0, stracks = 0;
+
+/* Memory shared by all tracks. A budget of 0 means no limit. */
+static size_t membudget = 0;
+static size_t memused = 0; // Changed atomically; tracks load in parallel.
+
+static unsigned lasttrackid = 0;
+
+// Get frame n of a track, packed or not. The rest of its block follows.
+static inline const int16_t *getframe(const track_t *t, int n)
+{
+	if (t->packed != NULL)
+		return pack_frame(t, n);
+	return &t->samples[(size_t)n*2];
+}
+
+// Get sample n of the given channel, or 0 past the end of the data.
+static inline int getsamp(const track_t *t, int n, int chan)
+{
+	const int16_t *frame;
+	int l, r;
+
+	if (n >= t->numsamples)
+		return 0;
+	frame = getframe(t, n);
+	l = frame[0];
+	r = frame[1];
+	switch (chan)
+	{
+	case CHAN_LEFT:  return l;
+	case CHAN_RIGHT: return r;
+	case CHAN_MID:   return (l + r) >> 1;
+	default:         return (l - r) >> 1;
+	}
+}
+
+// Get the minimum and maximum of num samples, starting at start.
+// chan is one of the CHAN_ constants.
+// This "raw" version does not use blocks.
+static void getminmax_raw(const track_t *t, int chan, int start, int num,
+	int *pmin, int *pmax)
+{
+	int min = MAXSAMP, max = MINSAMP;
+	int ix;
+	int samp[2];
+
+	if (num == 0)
+	{
+		*pmin = *pmax = 0;
+		return;
+	}
+
+	if (num & 1)
+	{
+		min = max = getsamp(t, start, chan);
+		start++, num--;
+	}
+
+	for (ix = 0; ix < num; ix += 2)
+	{
+		samp[0] = getsamp(t, start+ix, chan);
+		samp[1] = getsamp(t, start+ix+1, chan);
+		if (samp[1] < samp[0])
+		{
+			if (samp[1] < min)
+				min = samp[1];
+			if (samp[0] > max)
+				max = samp[0];
+		}
+		else
+		{
+			if (samp[0] < min)
+				min = samp[0];
+			if (samp[1] > max)
+				max = samp[1];
+		}
+	}
+
+	*pmin = min;
+	*pmax = max;
+}
+
+// Like getminmax_raw, but taking a start and end parameter for convenience.
+static void getminmax_raw_se(const track_t *t, int chan, int start, int end,
+	int *pmin, int *pmax)
+{
+	getminmax_raw(t, chan, start, end - start + 1, pmin, pmax);
+}
+
+// Calculate the sum of squares of samples and return it,
+// without using blocks to speed up the process.
+static double calcsos_raw(const track_t *t, int chan, int start, int num)
+{
+	int ix;
+	double total = 0.0;
+	const int end = start + num - 1;
+
+	if (num <= 0)
+		return 0.0;
+
+	for (ix = start; ix <= end; ix++)
+	{
+		const double f = getsamp(t, ix, chan) / SAMP_DIV_FLOAT;
+		total += f * f;
+	}
+	return total;
+}
+
+// Like calcsos_raw(), but takes a first and last sample value
+// to consider, for convenience.
+static double calcsos_raw_se(const track_t *t, int chan, int start, int end)
+{
+	return calcsos_raw(t, chan, start, end - start + 1);
+}
+
+// Calculate the sum of left times right samples, without using blocks.
+static double calcsop_raw(const track_t *t, int start, int num)
+{
+	int ix;
+	double total = 0.0;
+	const int end = start + num - 1;
+
+	if (num <= 0)
+		return 0.0;
+
+	for (ix = start; ix <= end; ix++)
+	{
+		total += getsamp(t, ix, CHAN_LEFT) / SAMP_DIV_FLOAT
+			* (getsamp(t, ix, CHAN_RIGHT) / SAMP_DIV_FLOAT);
+	}
+	return total;
+}
+
+// Like calcsop_raw(), but takes a first and last sample value.
+static double calcsop_raw_se(const track_t *t, int start, int end)
+{
+	return calcsop_raw(t, start, end - start + 1);
+}
+
+// Count the samples at full scale from start to end, without blocks.
+static int calcclips_raw_se(const track_t *t, int chan, int start, int end)
+{
+	int ix;
+	int count = 0;
+
+	for (ix = start; ix <= end; ix++)
+	{
+		const int samp = getsamp(t, ix, chan);
+		count += samp >= MAXSAMP || samp <= MINSAMP;
+	}
+	return count;
+}
+
+static void neednode(track_t *t, int level, int idx);
+
+/*
+ * Bytes taken by the summaries of a level of numnodes nodes. Blocks
+ * (level 0) hold at most SAMPLES_PER_BLOCK samples, so their level
+ * histograms take 16-bit counts.
+ */
+size_t track_levelbytes(int level, int numnodes)
+{
+	const level_t *l = NULL;
+	const size_t histbytes = HIST_BINS * (level == 0
+		? sizeof *l->blockhist[0] : sizeof *l->hist[0]);
+
+	return (size_t)numnodes * NUMCHANS * (sizeof *l->min[0]
+		+ sizeof *l->max[0] + sizeof *l->sumofsquares[0]
+		+ sizeof *l->clips[0] + histbytes)
+		+ (size_t)numnodes * sizeof
+		*l->sumofproducts + 2 * BITWORDS(numnodes) * sizeof *l->filled;
+}
+
+/*
+ * Make room in a level for numnodes nodes, at least as many as it has.
+ * New nodes are empty. A level_t of all zeroes is a level of none.
+ */
+void track_growlevel(level_t *l, int level, int numnodes)
+{
+	const size_t oldwords = BITWORDS(l->numnodes);
+	const size_t n = MAX(numnodes, 1), words = BITWORDS(n);
+	int chan;
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		l->min[chan] = xr(l->min[chan], sizeof *l->min[0], n);
+		l->max[chan] = xr(l->max[chan], sizeof *l->max[0], n);
+		l->sumofsquares[chan] = xr(l->sumofsquares[chan],
+			sizeof *l->sumofsquares[0], n);
+		l->clips[chan] = xr(l->clips[chan], sizeof *l->clips[0], n);
+		if (level == 0)
+		{
+			l->blockhist[chan] = xr(l->blockhist[chan],
+				sizeof *l->blockhist[0], n * HIST_BINS);
+		}
+		else
+		{
+			l->hist[chan] = xr(l->hist[chan], sizeof *l->hist[0],
+				n * HIST_BINS);
+		}
+	}
+	l->sumofproducts = xr(l->sumofproducts, sizeof *l->sumofproducts, n);
+	l->filling = xr(l->filling, sizeof *l->filling, words);
+	l->filled = xr(l->filled, sizeof *l->filled, words);
+	memset(&l->filling[oldwords], 0,
+		(words - oldwords) * sizeof *l->filling);
+	memset(&l->filled[oldwords], 0,
+		(words - oldwords) * sizeof *l->filled);
+	l->numnodes = numnodes;
+}
+
+void track_freelevel(level_t *l)
+{
+	int chan;
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		free(l->min[chan]);
+		free(l->max[chan]);
+		free(l->sumofsquares[chan]);
+		free(l->clips[chan]);
+		free(l->blockhist[chan]);
+		free(l->hist[chan]);
+	}
+	free(l->sumofproducts);
+	free(l->truepeak[0]);
+	free(l->truepeak[1]);
+	free(l->filling);
+	free(l->filled);
+	memset(l, 0, sizeof *l);
+}
+
+/*
+ * The quietest level of each level histogram bin but the last, as a
+ * sample magnitude: full scale times 10^(-HIST_STEP_DB*(i+1)/20),
+ * rounded up.
+ */
+static const int16_t histfloor[HIST_BINS - 1] = {
+	23198, 16423, 11627, 8231, 5828, 4126, 2921, 2068, 1464, 1037, 734,
+	520, 368, 261, 185
+};
+
+// Which level histogram bin a sample goes in.
+static inline int histbin(int samp)
+{
+	const int a = abs(samp);
+	int bin = 0;
+
+	while (bin < HIST_BINS - 1 && a < histfloor[bin])
+		bin++;
+	return bin;
+}
+
+typedef int16_t v8hi __attribute__((vector_size(16)));
+typedef uint16_t v8hu __attribute__((vector_size(16)));
+
+/*
+ * Fill in the level histograms of node idx of a level of blocks from
+ * its n frames. Rather than sort samples into bins one by one, this
+ * counts the samples at or above each bin's floor, 8 at a time with
+ * the vector extensions of GCC and Clang, and takes differences.
+ */
+static void histogram(level_t *l, int idx, const int16_t *frames, int n)
+{
+	v8hi mag[NUMCHANS][SAMPLES_PER_BLOCK / 8];
+	const int nvec = (n + 7) / 8;
+	int ix, chan, bin, lane;
+
+	// Magnitudes of each channel, with full scale, 32768, as 32767.
+	for (ix = 0; ix < nvec; ix++)
+	{
+		int16_t tail[16] = { 0 };
+		const int16_t *in = &frames[ix * 16];
+		v8hi left, right, s[NUMCHANS];
+
+		if (ix*8 + 8 > n)
+			in = memcpy(tail, in, (size_t)(n - ix*8) * 4);
+		for (lane = 0; lane < 8; lane++)
+		{
+			left[lane] = in[lane * 2];
+			right[lane] = in[lane * 2 + 1];
+		}
+
+		// (l+r)>>1 and (l-r)>>1 without overflowing 16 bits.
+		s[CHAN_LEFT] = left;
+		s[CHAN_RIGHT] = right;
+		s[CHAN_MID] = (left >> 1) + (right >> 1) + (left & right & 1);
+		s[CHAN_SIDE] = (left >> 1) - (right >> 1) - (~left & right & 1);
+
+		for (chan = 0; chan < NUMCHANS; chan++)
+		{
+			const v8hu neg = (v8hu)(s[chan] >> 15);
+			const v8hu m = ((v8hu)s[chan] ^ neg) - neg;
+
+			mag[chan][ix] = (v8hi)(m - (m >> 15));
+		}
+	}
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		uint16_t *const hist =
+			&l->blockhist[chan][(size_t)idx * HIST_BINS];
+		int above = 0;
+
+		for (bin = 0; bin < HIST_BINS - 1; bin++)
+		{
+			const v8hi least = (v8hi){ 0 } + histfloor[bin];
+			v8hi count = { 0 };
+			int total = 0;
+
+			// A true comparison is -1 in each lane.
+			for (ix = 0; ix < nvec; ix++)
+				count -= mag[chan][ix] >= least;
+			for (lane = 0; lane < 8; lane++)
+				total += count[lane];
+			hist[bin] = (uint16_t)(total - above);
+			above = total;
+		}
+		hist[HIST_BINS - 1] = (uint16_t)(n - above);
+	}
+}
+
+/*
+ * Fill in every summary of node idx of a level of blocks in one pass
+ * over its n frames: peaks, sums of squares, clip counts and level
+ * histograms for all channels, and the L*R sum. This leaves the node's
+ * state bits alone.
+ */
+void track_summarize(level_t *l, int idx, const int16_t *frames, int n)
+{
+	int min[NUMCHANS], max[NUMCHANS], clips[NUMCHANS];
+	double sumofsquares[NUMCHANS], sumofproducts = 0.0;
+	int ix, chan;
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		min[chan] = MAXSAMP;
+		max[chan] = MINSAMP;
+		sumofsquares[chan] = 0.0;
+		clips[chan] = 0;
+	}
+
+	for (ix = 0; ix < n; ix++)
+	{
+		int s[NUMCHANS];
+
+		s[CHAN_LEFT] = frames[ix*2];
+		s[CHAN_RIGHT] = frames[ix*2 + 1];
+		s[CHAN_MID] = (s[CHAN_LEFT] + s[CHAN_RIGHT]) >> 1;
+		s[CHAN_SIDE] = (s[CHAN_LEFT] - s[CHAN_RIGHT]) >> 1;
+
+		for (chan = 0; chan < NUMCHANS; chan++)
+		{
+			const double f = s[chan] / SAMP_DIV_FLOAT;
+			min[chan] = MIN(min[chan], s[chan]);
+			max[chan] = MAX(max[chan], s[chan]);
+			sumofsquares[chan] += f * f;
+			clips[chan] += (s[chan] >= MAXSAMP)
+				| (s[chan] <= MINSAMP);
+		}
+		sumofproducts += s[CHAN_LEFT] / SAMP_DIV_FLOAT
+			* (s[CHAN_RIGHT] / SAMP_DIV_FLOAT);
+	}
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		l->min[chan][idx] = (int16_t)min[chan];
+		l->max[chan][idx] = (int16_t)max[chan];
+		l->sumofsquares[chan][idx] = (float)sumofsquares[chan];
+		l->clips[chan][idx] = clips[chan];
+	}
+	l->sumofproducts[idx] = (float)sumofproducts;
+
+	histogram(l, idx, frames, n);
+}
+
+// Add the level histogram of node idx of a level to counts.
+static void addhist(int32_t *counts, const level_t *l, int chan, int idx)
+{
+	const size_t at = (size_t)idx * HIST_BINS;
+	int bin;
+
+	if (l->blockhist[chan] != NULL)
+	{
+		for (bin = 0; bin < HIST_BINS; bin++)
+			counts[bin] += l->blockhist[chan][at + bin];
+	}
+	else
+	{
+		for (bin = 0; bin < HIST_BINS; bin++)
+			counts[bin] += l->hist[chan][at + bin];
+	}
+}
+
+// Fill in a block of a track from its samples.
+static void fillblock(track_t *t, int block)
+{
+	const int first = block * SAMPLES_PER_BLOCK;
+
+	track_summarize(&t->levels[0], block, getframe(t, first),
+		MIN(SAMPLES_PER_BLOCK, t->numsamples - first));
+}
+
+// Combine the children of a node of a level above the blocks.
+static void fillnode(track_t *t, int level, int idx)
+{
+	level_t *const l = &t->levels[level];
+	const level_t *const c = &t->levels[level-1];
+	const int first = idx * SUMMARY_FANOUT;
+	const int last = MIN(first + SUMMARY_FANOUT, c->numnodes);
+	double sumofproducts = 0.0;
+	int ix, chan;
+
+	for (ix = first; ix < last; ix++)
+		neednode(t, level-1, ix);
+
+	for (chan = 0; chan < NUMCHANS; chan++)
+	{
+		int min = MAXSAMP, max = MINSAMP, clips = 0;
+		int32_t *const hist = &l->hist[chan][(size_t)idx * HIST_BINS];
+		double sumofsquares = 0.0;
+
+		memset(hist, 0, HIST_BINS * sizeof *hist);
+		for (ix = first; ix < last; ix++)
+		{
+			min = MIN(min, c->min[chan][ix]);
+			max = MAX(max, c->max[chan][ix]);
+			sumofsquares += c->sumofsquares[chan][ix];
+			clips += c->clips[chan][ix];
+			addhist(hist, c, chan, ix);
+		}
+		l->min[chan][idx] = (int16_t)min;
+		l->max[chan][idx] = (int16_t)max;
+		l->sumofsquares[chan][idx] = (float)sumofsquares;
+		l->clips[chan][idx] = clips;
+	}
+	for (ix = first; ix < last; ix++)
+		sumofproducts += c->sumofproducts[ix];
+	l->sumofproducts[idx] = (float)sumofproducts;
+}
+
+/*
+ * Make sure a node is filled in. If another thread is busy with it,
+ * wait for that rather than doing the same work twice.
+ */
+static void neednode(track_t *t, int level, int idx)
+{
+	level_t *const l = &t->levels[level];
+	unsigned long *const filled = &l->filled[BITWORD(idx)];
+	const unsigned long mask = BITMASK(idx);
+
+	if (__atomic_load_n(filled, __ATOMIC_ACQUIRE) & mask)
+		return;
+
+	if (!(__atomic_fetch_or(&l->filling[BITWORD(idx)], mask,
+		__ATOMIC_ACQUIRE) & mask))
+	{
+		if (level == 0)
+			fillblock(t, idx);
+		else
+			fillnode(t, level, idx);
+		__atomic_fetch_or(filled, mask, __ATOMIC_RELEASE);
+		return;
+	}
+
+	while (!(__atomic_load_n(filled, __ATOMIC_ACQUIRE) & mask))
+		sched_yield();
+}
+
+/* What a range query is adding up. */
+typedef struct
+{
+	int chan;
+	int min, max;
+	double total;
+	int count;
+	int32_t *hist; // HIST_BINS counts, for level histograms.
+} query_t;
+
+/*
+ * Go through the samples start..start+num-1, calling raw() on the bits
+ * at the edges that don't make up a whole block, and node() on the
+ * fewest summary nodes that cover the rest. Nodes are taken from as
+ * high a level as will fit, so a query costs O(log n) nodes plus at
+ * most two partial blocks however long the range is.
+ * Returns false if there is nothing to look at.
+ */
+static bool walkrange(track_t *t, int start, int num,
+	void (*node)(query_t *, const level_t *, int),
+	void (*raw)(query_t *, const track_t *, int, int), query_t *q)
+{
+	int end;
+	int lo, hi;
+	int level;
+
+	if (start + num > t->numsamples)
+		num = t->numsamples - start;
+	if (num <= 0)
+		return false;
+	end = start + num - 1;
+
+	/*
+	 * Whole blocks run from the first one starting at or after start
+	 * to the last one ending at or before end. The last block of the
+	 * track counts as whole even if it's short.
+	 */
+	lo = (start + SAMPLES_PER_BLOCK - 1) / SAMPLES_PER_BLOCK;
+	if (end == t->numsamples - 1)
+		hi = t->levels[0].numnodes - 1;
+	else
+		hi = (end + 1) / SAMPLES_PER_BLOCK - 1;
+
+	if (lo > hi)
+	{
+		raw(q, t, start, end);
+		return true;
+	}
+	if (start < lo * SAMPLES_PER_BLOCK)
+		raw(q, t, start, lo * SAMPLES_PER_BLOCK - 1);
+	if (end >= (hi+1) * SAMPLES_PER_BLOCK)
+		raw(q, t, (hi+1) * SAMPLES_PER_BLOCK, end);
+
+	assert(hi < t->levels[0].numnodes);
+
+	for (level = 0; lo <= hi; level++)
+	{
+		const bool top = level == t->numlevels - 1;
+
+		// Take nodes off each end until both line up with a
+		// node of the level above, then go up a level.
+		while (lo <= hi && (top || lo % SUMMARY_FANOUT != 0))
+		{
+			neednode(t, level, lo);
+			node(q, &t->levels[level], lo++);
+		}
+		while (lo <= hi && (hi+1) % SUMMARY_FANOUT != 0
+			&& hi != t->levels[level].numnodes - 1)
+		{
+			neednode(t, level, hi);
+			node(q, &t->levels[level], hi--);
+		}
+		if (lo > hi)
+			break;
+		lo /= SUMMARY_FANOUT;
+		hi /= SUMMARY_FANOUT;
+	}
+	return true;
+}
+
+static void minmax_node(query_t *q, const level_t *l, int idx)
+{
+	q->min = MIN(q->min, l->min[q->chan][idx]);
+	q->max = MAX(q->max, l->max[q->chan][idx]);
+}
+
+static void minmax_raw(query_t *q, const track_t *t, int first, int last)
+{
+	int tmpmin, tmpmax;
+
+	getminmax_raw_se(t, q->chan, first, last, &tmpmin, &tmpmax);
+	q->min = MIN(q->min, tmpmin);
+	q->max = MAX(q->max, tmpmax);
+}
+
+static void sos_node(query_t *q, const level_t *l, int idx)
+{
+	q->total += l->sumofsquares[q->chan][idx];
+}
+
+static void sos_raw(query_t *q, const track_t *t, int first, int last)
+{
+	q->total += calcsos_raw_se(t, q->chan, first, last);
+}
+
+static void sop_node(query_t *q, const level_t *l, int idx)
+{
+	q->total += l->sumofproducts[idx];
+}
+
+static void sop_raw(query_t *q, const track_t *t, int first, int last)
+{
+	q->total += calcsop_raw_se(t, first, last);
+}
+
+static void clips_node(query_t *q, const level_t *l, int idx)
+{
+	q->count += l->clips[q->chan][idx];
+}
+
+static void clips_raw(query_t *q, const track_t *t, int first, int last)
+{
+	q->count += calcclips_raw_se(t, q->chan, first, last);
+}
+
+static void hist_node(query_t *q, const level_t *l, int idx)
+{
+	addhist(q->hist, l, q->chan, idx);
+}
+
+static void hist_raw(query_t *q, const track_t *t, int first, int last)
+{
+	int ix;
+
+	for (ix = first; ix <= last; ix++)
+		q->hist[histbin(getsamp(t, ix, q->chan))]++;
+}
+
+/*
+ * Get the true peak of samples first..last of chan (left or right).
+ * Packed samples are unpacked a block at a time, with a margin either
+ * side for the oversampling filter.
+ */
+static float truepeakof(const track_t *t, int chan, int first, int last)
+{
+	int16_t buf[2 * (SAMPLES_PER_BLOCK + 2 * TRUEPEAK_MARGIN)];
+	float peak = 0.0f;
+	int piece, n;
+
+	if (t->packed == NULL)
+	{
+		return oversampledpeak(t->samples, t->numsamples, chan,
+			first, last);
+	}
+
+	for (piece = first; piece <= last; piece += SAMPLES_PER_BLOCK)
+	{
+		const int end = MIN(piece + SAMPLES_PER_BLOCK - 1, last);
+		const int from = MAX(piece - TRUEPEAK_MARGIN, 0);
+		const int to = MIN(end + TRUEPEAK_MARGIN, t->numsamples - 1);
+
+		for (n = from; n <= to; n++)
+			memcpy(&buf[(n - from) * 2], getframe(t, n), 4);
+		peak = MAX(peak, oversampledpeak(buf, to - from + 1, chan,
+			piece - from, end - from));
+	}
+	return peak;
+}
+
+static void truepeak_node(query_t *q, const level_t *l, int idx)
+{
+	q->total = MAX(q->total, l->truepeak[q->chan][idx]);
+}
+
+static void truepeak_raw(query_t *q, const track_t *t, int first, int last)
+{
+	q->total = MAX(q->total, truepeakof(t, q->chan, first, last));
+}
+
+// Get the minimum and maximum of num samples, starting at start.
+// chan is one of the CHAN_ constants.
+void getminmax(track_t *t, int chan, int start, int num, int *pmin, int *pmax)
+{
+	query_t q = { chan, MAXSAMP, MINSAMP, 0.0, 0, NULL };
+
+	if (!walkrange(t, start, num, minmax_node, minmax_raw, &q))
+	{
+		*pmin = *pmax = 0;
+		return;
+	}
+	*pmin = q.min;
+	*pmax = q.max;
+}
+
+// Calculate the sum of squares of samples and return it.
+double calcsos(track_t *t, int chan, int start, int num)
+{
+	query_t q = { chan, MAXSAMP, MINSAMP, 0.0, 0, NULL };
+
+	walkrange(t, start, num, sos_node, sos_raw, &q);
+	return q.total;
+}
+
+// Calculate the sum of left times right samples and return it.
+double calcsop(track_t *t, int start, int num)
+{
+	query_t q = { CHAN_LEFT, MAXSAMP, MINSAMP, 0.0, 0, NULL };
+
+	walkrange(t, start, num, sop_node, sop_raw, &q);
+	return q.total;
+}
+
+// Count the samples at full scale (clipped, most likely).
+int calcclips(track_t *t, int chan, int start, int num)
+{
+	query_t q = { chan, MAXSAMP, MINSAMP, 0.0, 0, NULL };
+
+	walkrange(t, start, num, clips_node, clips_raw, &q);
+	return q.count;
+}
+
+/*
+ * Count the samples of a range in each bin of a level histogram (see
+ * HIST_BINS), into hist. Like the peaks, this comes from the summaries,
+ * so it takes time in proportion to the log of the length.
+ */
+void calchist(track_t *t, int chan, int start, int num,
+	int32_t hist[HIST_BINS])
+{
+	query_t q = { chan, MAXSAMP, MINSAMP, 0.0, 0, hist };
+
+	memset(hist, 0, HIST_BINS * sizeof *hist);
+	walkrange(t, start, num, hist_node, hist_raw, &q);
+}
+
+// Calculate the RMS average and return it.
+double calcrms(track_t *t, int chan, int start, int num)
+{
+	return sqrt(calcsos(t, chan, start, num) / num);
+}
+
+/*
+ * Calculate the correlation coefficient between left and right,
+ * from -1 (out of phase) to +1 (mono). Silence counts as 0.
+ */
+double calccorr(track_t *t, int start, int num)
+{
+	const double denom = sqrt(calcsos(t, CHAN_LEFT, start, num)
+		* calcsos(t, CHAN_RIGHT, start, num));
+
+	if (denom < DBL_EPSILON)
+		return 0.0;
+	return calcsop(t, start, num) / denom;
+}
+
+/*
+ * Return the true peak of num samples from start, as a sample value,
+ * or -1 if the true peak pass isn't done. chan is CHAN_LEFT or
+ * CHAN_RIGHT.
+ */
+double calctruepeak(track_t *t, int chan, int start, int num)
+{
+	query_t q = { chan, MAXSAMP, MINSAMP, 0.0, 0, NULL };
+
+	if (!track_truepeakready(t))
+		return -1.0;
+	walkrange(t, start, num, truepeak_node, truepeak_raw, &q);
+	return q.total;
+}
+
+// Set the memory budget shared by all tracks, in bytes. 0 means none.
+void track_setmembudget(size_t bytes)
+{
+	membudget = bytes;
+}
+
+// Count bytes against the memory budget, bombing out if it's exceeded.
+void track_charge(size_t bytes, const char *what)
+{
+	const size_t used = __atomic_add_fetch(&memused, bytes,
+		__ATOMIC_RELAXED);
+
+	if (membudget != 0 && used > membudget)
+	{
+		errquit("memory budget of %lu MB exceeded by %s",
+			(unsigned long)(membudget >> 20), what);
+	}
+}
+
+// Give back bytes charged by track_charge().
+void track_uncharge(size_t bytes)
+{
+	__atomic_sub_fetch(&memused, bytes, __ATOMIC_RELAXED);
+}
+
+// Return how many bytes are charged against the budget altogether.
+size_t track_memused(void)
+{
+	return __atomic_load_n(&memused, __ATOMIC_RELAXED);
+}
+
+/*
+ * Make a track out of interleaved stereo samples. If blocks is not
+ * NULL, it holds every block already summarized by track_summarize().
+ * Otherwise, and for the levels above, the summaries are allocated but
+ * not filled in yet; the background workers and the query functions
+ * take care of that.
+ *
+ * The caller holds the one reference to the new track, and should add
+ * whatever it charged for the samples (and blocks) to membytes.
+ */
+track_t *track_new(const char *name, int16_t *samples, int numsamples,
+	int samprate, level_t *blocks)
+{
+	track_t *t = xm(sizeof *t, 1);
+	int level, n;
+
+	t->name = name;
+	t->samples = samples;
+	t->mapping = NULL;
+	t->maplen = 0;
+	t->packed = NULL;
+	t->packedat = NULL;
+	t->id = __atomic_add_fetch(&lasttrackid, 1, __ATOMIC_RELAXED);
+	t->numsamples = numsamples;
+	t->samprate = samprate;
+	t->nextfill = 0;
+	t->nexttruepeak = -1;
+	t->truepeakleft = 0;
+	t->truepeakready = false;
+	t->refs = 1;
+	t->membytes = 0;
+
+	/*
+	 * Each level summarizes SUMMARY_FANOUT nodes of the one below,
+	 * up to a level with a single node.
+	 */
+	n = (numsamples + SAMPLES_PER_BLOCK - 1) / SAMPLES_PER_BLOCK;
+	for (level = 0; level < SUMMARY_LEVELS; level++)
+	{
+		level_t *const l = &t->levels[level];
+
+		if (level == 0 && blocks != NULL)
+		{
+			*l = *blocks;
+			l->numnodes = n;
+			if (n > 0) // Else there may be no bits to set.
+			{
+				memset(l->filled, 0xff,
+					BITWORDS(n) * sizeof *l->filled);
+			}
+		}
+		else
+		{
+			track_charge(track_levelbytes(level, n), name);
+			t->membytes += track_levelbytes(level, n);
+			memset(l, 0, sizeof *l);
+			track_growlevel(l, level, n);
+		}
+		if (n <= 1)
+			break;
+		n = (n + SUMMARY_FANOUT - 1) / SUMMARY_FANOUT;
+	}
+	t->numlevels = MIN(level + 1, SUMMARY_LEVELS);
+
+	pthread_mutex_lock(&trackslock);
+	XPND(tracks, ntracks, stracks);
+	tracks[ntracks++] = t;
+	pthread_mutex_unlock(&trackslock);
+
+	pool_kick();
+	return t;
+}
+
+/*
+ * Let go of a reference to a track. When the last one goes, the track
+ * is taken off the background workers' list, its memory is given back
+ * to the budget, and it's freed. The name belongs to the caller.
+ */
+void track_release(track_t *t)
+{
+	bool last;
+	int i;
+
+	pthread_mutex_lock(&trackslock);
+	last = --t->refs == 0;
+	if (last)
+	{
+		for (i = 0; tracks[i] != t; i++)
+			;
+		tracks[i] = tracks[--ntracks];
+	}
+	pthread_mutex_unlock(&trackslock);
+	if (!last)
+		return;
+
+	for (i = 0; i < t->numlevels; i++)
+		track_freelevel(&t->levels[i]);
+	if (t->mapping != NULL)
+		munmap(t->mapping, t->maplen);
+	else
+		free(t->samples);
+	free(t->packed);
+	free(t->packedat);
+	track_uncharge(t->membytes);
+	free(t);
+}
+
+/*
+ * Fill in the chunk of blocks of a track starting at block, and the
+ * nodes above them. A chunk is exactly one level 2 node, so filling
+ * that in fills in its blocks and the level 1 nodes between.
+ */
+static void fillchunk(track_t *t, int block)
+{
+	const int level = MIN(2, t->numlevels - 1);
+
+	neednode(t, level, level == 2 ? block / FILL_CHUNK : 0);
+}
+
+static void fillchunk_for(void *arg, int i)
+{
+	fillchunk(arg, i * FILL_CHUNK);
+}
+
+/*
+ * Fill in every summary of a track, using the whole worker pool, and
+ * return when that's done.
+ */
+void track_fillall(track_t *t)
+{
+	const int top = t->numlevels - 1;
+	int i;
+
+	pool_for(fillchunk_for, t,
+		(t->levels[0].numnodes + FILL_CHUNK - 1) / FILL_CHUNK);
+	for (i = 0; i < t->levels[top].numnodes; i++)
+		neednode(t, top, i);
+	__atomic_store_n(&t->nextfill, t->levels[0].numnodes, __ATOMIC_RELAXED);
+}
+
+/*
+ * True peaks are worked out by a pass of their own, only once they're
+ * asked for, as they take far longer than the other summaries. The
+ * background workers take it a chunk of blocks at a time, after the
+ * track's other summaries. Each chunk fills in its blocks and the
+ * level 1 and 2 nodes over them; the last chunk to finish fills in the
+ * levels above, and then queries may use them.
+ */
+
+// Set a node's true peaks from its children.
+static void truepeaknode(track_t *t, int level, int idx)
+{
+	level_t *const l = &t->levels[level];
+	const level_t *const c = &t->levels[level-1];
+	const int first = idx * SUMMARY_FANOUT;
+	const int last = MIN(first + SUMMARY_FANOUT, c->numnodes);
+	int chan, ix;
+
+	for (chan = 0; chan < 2; chan++)
+	{
+		float peak = 0.0f;
+
+		for (ix = first; ix < last; ix++)
+			peak = MAX(peak, c->truepeak[chan][ix]);
+		l->truepeak[chan][idx] = peak;
+	}
+}
+
+static void truepeakchunk(track_t *t, int block)
+{
+	level_t *const blocks = &t->levels[0];
+	const int last = MIN(block + FILL_CHUNK, blocks->numnodes);
+	int b, chan, level, span, idx;
+
+	for (b = block; b < last; b++)
+	{
+		const int first = b * SAMPLES_PER_BLOCK;
+		const int n = MIN(SAMPLES_PER_BLOCK, t->numsamples - first);
+
+		for (chan = 0; chan < 2; chan++)
+		{
+			blocks->truepeak[chan][b] = truepeakof(t, chan,
+				first, first + n - 1);
+		}
+	}
+
+	for (level = 1, span = SUMMARY_FANOUT;
+		level <= MIN(2, t->numlevels - 1);
+		level++, span *= SUMMARY_FANOUT)
+	{
+		for (idx = block / span; idx <= (last - 1) / span; idx++)
+			truepeaknode(t, level, idx);
+	}
+
+	if (__atomic_sub_fetch(&t->truepeakleft, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (level = 3; level < t->numlevels; level++)
+		for (idx = 0; idx < t->levels[level].numnodes; idx++)
+			truepeaknode(t, level, idx);
+	__atomic_store_n(&t->truepeakready, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Start the true peak pass of a track in the background, if it hasn't
+ * been started already. Call this from one thread only.
+ */
+void track_starttruepeak(track_t *t)
+{
+	int level, chan, block;
+
+	if (t->levels[0].truepeak[0] != NULL)
+		return;
+
+	for (level = 0; level < t->numlevels; level++)
+	{
+		level_t *const l = &t->levels[level];
+		const size_t bytes = 2 * MAX(l->numnodes, 1)
+			* sizeof *l->truepeak[0];
+
+		track_charge(bytes, t->name);
+		t->membytes += bytes;
+		for (chan = 0; chan < 2; chan++)
+		{
+			l->truepeak[chan] = xm(sizeof *l->truepeak[0],
+				MAX(l->numnodes, 1));
+		}
+	}
+	t->truepeakleft = (t->levels[0].numnodes + FILL_CHUNK - 1)
+		/ FILL_CHUNK;
+	if (t->truepeakleft == 0)
+	{
+		t->truepeakready = true; // No samples.
+		return;
+	}
+
+	// With no workers, there's no background; do it now.
+	if (pool_numthreads() == 0)
+	{
+		for (block = 0; block < t->levels[0].numnodes;
+			block += FILL_CHUNK)
+		{
+			truepeakchunk(t, block);
+		}
+		t->nexttruepeak = t->levels[0].numnodes;
+		return;
+	}
+	__atomic_store_n(&t->nexttruepeak, 0, __ATOMIC_RELEASE);
+	pool_kick();
+}
+
+bool track_truepeakready(track_t *t)
+{
+	return __atomic_load_n(&t->truepeakready, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Find the first block of a node's subtree, from block b0 on, whose
+ * true peak goes over full scale. Returns -1 if there's none.
+ */
+static int findover(track_t *t, int level, int idx, int b0)
+{
+	const level_t *const l = &t->levels[level];
+	int span = 1, i, child;
+
+	for (i = 0; i < level; i++)
+		span *= SUMMARY_FANOUT;
+	if ((idx + 1) * span <= b0 || (l->truepeak[0][idx] <= SAMP_DIV_FLOAT
+		&& l->truepeak[1][idx] <= SAMP_DIV_FLOAT))
+	{
+		return -1;
+	}
+	if (level == 0)
+		return idx;
+
+	for (i = 0; i < SUMMARY_FANOUT; i++)
+	{
+		child = idx * SUMMARY_FANOUT + i;
+		if (child >= t->levels[level-1].numnodes)
+			break;
+		if ((child = findover(t, level-1, child, b0)) >= 0)
+			return child;
+	}
+	return -1;
+}
+
+static bool blockover(const track_t *t, int b)
+{
+	return t->levels[0].truepeak[0][b] > SAMP_DIV_FLOAT
+		|| t->levels[0].truepeak[1][b] > SAMP_DIV_FLOAT;
+}
+
+/*
+ * Return the first sample of the next run of blocks whose true peaks
+ * go over full scale, after the run sample from is in, if any. Returns
+ * -1 if there's none (or the true peak pass isn't done).
+ */
+int track_nextover(track_t *t, int from)
+{
+	const int top = t->numlevels - 1;
+	int i, b = MAX(from, 0) / SAMPLES_PER_BLOCK, next;
+
+	if (!track_truepeakready(t))
+		return -1;
+	while (b < t->levels[0].numnodes && blockover(t, b))
+		b++;
+	for (i = 0; i < t->levels[top].numnodes; i++)
+	{
+		next = findover(t, top, i, b);
+		if (next >= 0)
+			return next * SAMPLES_PER_BLOCK;
+	}
+	return -1;
+}
+
+/*
+ * Background work for the worker pool: fill in a chunk of blocks of
+ * some track, and the nodes above them, or else do a chunk of a true
+ * peak pass. Returns false once every track has been gone through.
+ */
+static bool fillsome(void)
+{
+	int i;
+
+	for (i = 0; ; i++)
+	{
+		track_t *t;
+		int block, next;
+		bool filled = false;
+
+		// Hold a reference so the track can't be freed meanwhile.
+		pthread_mutex_lock(&trackslock);
+		t = i < ntracks ? tracks[i] : NULL;
+		if (t != NULL)
+			t->refs++;
+		pthread_mutex_unlock(&trackslock);
+		if (t == NULL)
+			return false;
+
+		if (__atomic_load_n(&t->nextfill, __ATOMIC_RELAXED)
+			< t->levels[0].numnodes)
+		{
+			block = __atomic_fetch_add(&t->nextfill, FILL_CHUNK,
+				__ATOMIC_RELAXED);
+			if (block < t->levels[0].numnodes)
+			{
+				fillchunk(t, block);
+				filled = true;
+			}
+		}
+		else if ((next = __atomic_load_n(&t->nexttruepeak,
+			__ATOMIC_ACQUIRE)) >= 0 && next < t->levels[0].numnodes)
+		{
+			block = __atomic_fetch_add(&t->nexttruepeak, FILL_CHUNK,
+				__ATOMIC_RELAXED);
+			if (block < t->levels[0].numnodes)
+			{
+				truepeakchunk(t, block);
+				filled = true;
+			}
+		}
+
+		track_release(t);
+		if (filled)
+			return true;
+	}
+}
+
+// Start filling in the blocks of every track in the background.
+void track_startworkers(void)
+{
+	pool_init(pool_numcpus() - 1);
+	pool_setidle(fillsome);
+}
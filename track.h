@@ -0,0 +1,94 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Channels that can be displayed or summarized. Mid and side are derived
+ * from the left and right samples: mid = (L+R)/2, side = (L-R)/2.
+ */
+enum { CHAN_LEFT = 0, CHAN_RIGHT, CHAN_MID, CHAN_SIDE, NUMCHANS };
+
+#define SAMP_DIV_FLOAT 32768.0 // Divide by this to convert to a float.
+#define MAXSAMP 32767
+#define MINSAMP -32768
+
+/*
+ * Peak and RMS info about blocks. The blocks are summarized in turn by
+ * levels of bigger nodes, SUMMARY_FANOUT to a node. Each level keeps
+ * every kind of summary in an array of its own, one entry per node, so
+ * a query for peaks doesn't drag sums of squares through the cache.
+ * Sums are kept as floats; queries add them up as doubles.
+ */
+#define SAMPLES_PER_BLOCK 1024
+#define SUMMARY_FANOUT 16
+#define SUMMARY_LEVELS 8
+
+/*
+ * Level histograms count samples by their level: bin i holds levels
+ * from -HIST_STEP_DB*(i+1) up to -HIST_STEP_DB*i dBFS, and the last bin
+ * also holds everything quieter, silence included.
+ */
+#define HIST_BINS 16
+#define HIST_STEP_DB 3
+
+typedef struct
+{
+	int16_t *min[NUMCHANS], *max[NUMCHANS];
+	float *sumofsquares[NUMCHANS]; // Mid/side entries are their energy.
+	float *sumofproducts; // Sum of left times right, for correlation.
+	int32_t *clips[NUMCHANS]; // Samples at full scale.
+	uint16_t *blockhist[NUMCHANS]; // Level 0: HIST_BINS counts per block.
+	int32_t *hist[NUMCHANS]; // Levels above: the same, added up.
+	float *truepeak[2]; // Left, right; NULL until track_starttruepeak().
+	unsigned long *filling, *filled; // Bitsets of node states.
+	int numnodes;
+} level_t;
+
+/* One loaded file: its samples and their block summaries. */
+typedef struct
+{
+	const char *name;
+	int16_t *samples; // Interleaved left/right, or NULL if packed.
+	void *mapping; // If not NULL, the samples lie in this mapped file.
+	size_t maplen;
+	unsigned char *packed; // If not NULL, the samples; see pack.c.
+	size_t *packedat; // Where each block starts in packed, and the end.
+	unsigned id; // Tells tracks apart, even at the same address.
+	int numsamples; // Number of samples per channel.
+	int samprate;
+	level_t levels[SUMMARY_LEVELS]; // levels[0] holds the blocks.
+	int numlevels;
+	int nextfill; // Next block for the background workers to look at.
+	int nexttruepeak; // Same for the true peak pass; -1 if not wanted.
+	int truepeakleft; // Chunks of the true peak pass not done yet.
+	bool truepeakready; // Is the true peak pass all done?
+	int refs; // Holders of the track; see track_release().
+	size_t membytes; // Charged against the memory budget for it.
+} track_t;
+
+track_t *track_new(const char *name, int16_t *samples, int numsamples,
+	int samprate, level_t *blocks);
+size_t track_levelbytes(int level, int numnodes);
+void track_growlevel(level_t *l, int level, int numnodes);
+void track_freelevel(level_t *l);
+void track_summarize(level_t *l, int idx, const int16_t *frames, int n);
+void track_fillall(track_t *t);
+void track_setmembudget(size_t bytes);
+void track_charge(size_t bytes, const char *what);
+void track_uncharge(size_t bytes);
+size_t track_memused(void);
+void track_release(track_t *t);
+void track_startworkers(void);
+void track_starttruepeak(track_t *t);
+bool track_truepeakready(track_t *t);
+int track_nextover(track_t *t, int from);
+
+void getminmax(track_t *t, int chan, int start, int num, int *pmin, int *pmax);
+double calcsos(track_t *t, int chan, int start, int num);
+double calcsop(track_t *t, int start, int num);
+double calcrms(track_t *t, int chan, int start, int num);
+int calcclips(track_t *t, int chan, int start, int num);
+double calccorr(track_t *t, int start, int num);
+double calctruepeak(track_t *t, int chan, int start, int num);
+void calchist(track_t *t, int chan, int start, int num,
+	int32_t hist[HIST_BINS]);
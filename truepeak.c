@@ -0,0 +1,127 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "truepeak.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * True peaks: the peaks of the signal between the samples, as a D/A
+ * converter would reconstruct it, found by oversampling 4 times.
+ *
+ * The oversampling filter is polyphase. It's a windowed sinc of
+ * TP_PHASES * TP_TAPS taps, of which phase p (every TP_PHASES'th tap,
+ * starting at p) makes the output a quarter of a sample further along.
+ * Phase 0 is the samples themselves, so a true peak is never below the
+ * sample peak. The phases are worked out side by side, one to each
+ * lane of a vector, so each input sample costs TP_TAPS vector
+ * multiply-adds. GCC's vector extensions make those SSE or NEON
+ * instructions, or plain code where there are none.
+ */
+
+#define TP_PHASES 4
+#define TP_TAPS 12 // Per phase.
+#define TP_DELAY (TP_TAPS / 2) // Of the filter, in samples.
+#define TP_PIECE 1024 // Samples converted to float at a time.
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+/* coefs[k] holds tap k of each phase. */
+static v4sf coefs[TP_TAPS];
+static pthread_once_t coefsonce = PTHREAD_ONCE_INIT;
+
+static void makecoefs(void)
+{
+	const int half = TP_DELAY * TP_PHASES;
+	double h[TP_PHASES * TP_TAPS], sum[TP_PHASES] = { 0.0 };
+	int j, k, p;
+
+	// A sinc cut off at the original Nyquist, in a Blackman window.
+	for (j = 0; j < TP_PHASES * TP_TAPS; j++)
+	{
+		const double t = (double)(j - half) / TP_PHASES;
+		const double w = 0.42 + 0.5 * cos(M_PI * (j - half) / half)
+			+ 0.08 * cos(2.0 * M_PI * (j - half) / half);
+
+		h[j] = (j == half ? 1.0 : sin(M_PI * t) / (M_PI * t)) * w;
+		sum[j % TP_PHASES] += h[j];
+	}
+
+	// Give each phase a gain of exactly 1 at DC.
+	for (k = 0; k < TP_TAPS; k++)
+		for (p = 0; p < TP_PHASES; p++)
+			coefs[k][p] = (float)(h[k * TP_PHASES + p] / sum[p]);
+}
+
+static inline v4sf vmax(v4sf a, v4sf b)
+{
+	const v4si m = a > b;
+
+	return (v4sf)((m & (v4si)a) | (~m & (v4si)b));
+}
+
+static inline v4sf vmin(v4sf a, v4sf b)
+{
+	const v4si m = a < b;
+
+	return (v4sf)((m & (v4si)a) | (~m & (v4si)b));
+}
+
+/*
+ * Return the true peak level, as a sample value (so it may be more
+ * than full scale), of samples first..last of channel chan (0 or 1)
+ * of numsamples interleaved stereo samples. Samples outside the data
+ * count as silence.
+ */
+float oversampledpeak(const int16_t *samples, int numsamples, int chan,
+	int first, int last)
+{
+	float x[TP_PIECE + TP_TAPS - 1];
+	v4sf hi = { 0.0f }, lo = { 0.0f };
+	float peak = 0.0f;
+	int piece, i, k, p;
+
+	pthread_once(&coefsonce, makecoefs);
+
+	for (piece = first; piece <= last; piece += TP_PIECE)
+	{
+		const int n = MIN(TP_PIECE, last - piece + 1);
+		const int base = piece + TP_DELAY - (TP_TAPS - 1);
+
+		// x[i] is sample base + i. The output for sample
+		// piece + i comes from x[i] .. x[i + TP_TAPS - 1].
+		for (i = 0; i < n + TP_TAPS - 1; i++)
+		{
+			const int s = base + i;
+
+			x[i] = s >= 0 && s < numsamples
+				? samples[(size_t)s * 2 + chan] : 0.0f;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			const float *const in = &x[i + TP_TAPS - 1];
+			v4sf acc = coefs[0] * in[0];
+
+			for (k = 1; k < TP_TAPS; k++)
+				acc += coefs[k] * in[-k];
+			hi = vmax(hi, acc);
+			lo = vmin(lo, acc);
+		}
+	}
+
+	for (p = 0; p < TP_PHASES; p++)
+	{
+		if (hi[p] > peak)
+			peak = hi[p];
+		if (-lo[p] > peak)
+			peak = -lo[p];
+	}
+	return peak;
+}
@@ -0,0 +1,7 @@
+#include <stdint.h>
+
+/* Samples either side of a range that oversampledpeak() looks at. */
+#define TRUEPEAK_MARGIN 8
+
+float oversampledpeak(const int16_t *samples, int numsamples, int chan,
+	int first, int last);
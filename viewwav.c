@@ -6,6 +6,9 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef WIN32
 #define _REST(ms) rest(ms)
 #else
@@ -19,745 +22,466 @@
 
 #include <allegro.h>
 #include "xm.h"
-#include "readfile.h"
 #include "errquit.h"
 #include "binmode.h"
-
-/* XXX */
-#ifndef DBL_EPSILON
-#define DBL_EPSILON 2.2204460492503131E-16
-#endif
+#include "pool.h"
+#include "track.h"
+#include "pack.h"
+#include "synth.h"
+#include "load.h"
+#include "render.h"
+#include "serve.h"
 
 #undef MIN
 #undef MAX
+#undef MID
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MID(lo,x,hi) MAX(lo, MIN(x, hi))
 
 #define DEF_SCRWIDTH 800
 #define DEF_SCRHEIGHT 600
 #define DEF_RATE 44100
+#define DEF_SERVE_MEM 1024 // MB the tile server keeps files in.
 
 static int samprate = DEF_RATE;
 
-#define READKEY(val,ascii) do {		\
-	while (!keypressed())		\
-		_REST(12);		\
-	val = readkey();		\
-	ascii = val & 0xff;		\
-	val >>= 8;			\
-} while(0)
-
 static int scrwidth = DEF_SCRWIDTH;
 static int scrheight = DEF_SCRHEIGHT;
 
-static int16_t *samples;
-static int numsamples; // Number of samples per channel.
-static int zoom = 1; /* Number of samples in each pixel. */
-static int vzoom = 0; /* Amplitude shown as 2^this times real amplitude. */
-static int pos = 0; /* Sample value at leftmost pixel. */
-static int logdisp = 0; /* Use logarithmic display? */
-static int peakdisp = 1; /* Show peaks? */
-static int rmsdisp = 0; /* Show RMS averages? */
-static BITMAP *buffer;
-
-#define VZOOM_MIN 0
-#define VZOOM_MAX 15
-
-/* Peak and RMS info about blocks. */
-#define SAMPLES_PER_BLOCK 1024
-static int numblocks = 0;
-#define PEAK_FILLED_IN(chan) (1<<(2*(chan)))
-#define SOS_FILLED_IN(chan) (1<<(2*(chan)+1))
-typedef struct
-{
-	double sumofsquares[2];
-	int max[2], min[2];
-	unsigned char filledin; // The two flags OR'd together.
-} block_t;
-static block_t *blocks;
-
-enum
-{
-	BLACK = 0, BLUE, GREEN, CYAN, RED, MAGENTA, BROWN,
-	LIGHT_GRAY, GRAY, LIGHT_BLUE, LIGHT_GREEN, LIGHT_CYAN,
-	LIGHT_RED, LIGHT_MAGENTA, YELLOW, WHITE
-};
-
-#define SCREEN_BG GRAY
-#define CHANNEL_BG BLACK
-#define CHANNEL_LOG_PEAK_COLOR LIGHT_GREEN
-#define CHANNEL_LIN_PEAK_COLOR LIGHT_GREEN
-#define CHANNEL_LOG_RMS_COLOR LIGHT_CYAN
-#define CHANNEL_LIN_RMS_COLOR CYAN
-#define CHANNEL_DCLINE_COLOR LIGHT_GRAY
-#define CHANNEL_LOGGUIDE_COLOR_MAJOR (makecol(120, 120, 120))
-#define CHANNEL_LOGGUIDE_COLOR_MINOR (makecol(92, 92, 92))
-#define CHANNEL_LOGGUIDE_SPACING 6 // 6 dB between guide lines.
-#define CHANNEL_LOGGUIDE_MAJOR_SPACING (2*CHANNEL_LOGGUIDE_SPACING)
-#define MAX_DB_RANGE 96.0
-#define MARKER_FG WHITE
-#define MARKER_TEXT WHITE
-
-#define RMS_MIN_SAMPLES(rate) ((int)(rate * 0.001))
-
-#define GETSAMP(n,s,o)				\
-	if ((n) >= numsamples)			\
-		(s) = 0;			\
-	else					\
-		(s) = samples[(n)*2 + o];
-
-#define SAMP_DIV_FLOAT 32768.0 // Divide by this to convert to a float.
-#define MAXSAMP 32767
-#define MINSAMP -32768
-
-// Get the minimum and maximum of num samples, starting at start.
-// odd == 1 means get right-channel samples, otherwise left.
-// This "raw" version does not use blocks.
-static void getminmax_raw(int odd, int start, int num, int *pmin, int *pmax)
-{
-	int min = MAXSAMP, max = MINSAMP;
-	int ix;
-	int samp[2];
-
-	if (num == 0)
-	{
-		*pmin = *pmax = 0;
-		return;
-	}
-
-	if (num & 1)
-	{
-		GETSAMP(start, min, odd)
-		max = min;
-		start++, num--;
-	}
-
-	for (ix = 0; ix < num; ix += 2)
-	{
-		GETSAMP(start+ix, samp[0], odd)
-		GETSAMP(start+ix+1, samp[1], odd)
-		if (samp[1] < samp[0])
-		{
-			if (samp[1] < min)
-				min = samp[1];
-			if (samp[0] > max)
-				max = samp[0];
-		}
-		else
-		{
-			if (samp[0] < min)
-				min = samp[0];
-			if (samp[1] > max)
-				max = samp[1];
-		}
-	}
+static view_t view; // What's on the screen.
 
-	*pmin = min;
-	*pmax = max;
-}
+/* Fine zoom changes by 2^(1/8), so eight steps double the zoom. */
+#define ZOOM_STEP 1.0905077326652577
 
-// Like getminmax_raw, but taking a start and end parameter for convenience.
-static void getminmax_raw_se(int odd, int start, int end, int *pmin, int *pmax)
-{
-	getminmax_raw(odd, start, end - start + 1, pmin, pmax);
-}
+/* How many tracks' true peaks were there to draw, last time. */
+static int truepeaksdrawn = 0;
 
-// Calculate the sum of squares of samples and return it,
-// without using blocks to speed up the process.
-static double calcsos_raw(int odd, int start, int num)
+static int truepeaksready(void)
 {
-	int ix;
-	int samp;
-	double total = 0.0;
-	const int end = start + num - 1;
-
-	if (num <= 0)
-		return 0.0;
-
-	for (ix = start; ix <= end; ix++)
-	{
-		double f;
+	int i, n = 0;
 
-		GETSAMP(ix, samp, odd)
-		f = samp / SAMP_DIV_FLOAT;
-		total += f * f;
-	}
-	return total;
+	for (i = 0; i < view.ntracks; i++)
+		n += track_truepeakready(view.tracks[i]);
+	return n;
 }
 
-// Like calcsos_raw(), but takes a first and last sample value
-// to consider, for convenience.
-static double calcsos_raw_se(int odd, int start, int end)
-{
-	return calcsos_raw(odd, start, end - start + 1);
-}
-
-// Get the minimum and maximum of num samples, starting at start.
-// odd == 1 means get right-channel samples, otherwise left.
-static void getminmax(int odd, int start, int num, int *pmin, int *pmax)
+static void draw(void)
 {
-	int min = MAXSAMP, max = MINSAMP;
-	int block;
-	int startblock, endblock;
-	int end;
-	int blockmin, blockmax;
-	int tmpmin, tmpmax;
-
-	if (start + num > numsamples)
-		num = numsamples - start;
-	if (num <= 0)
-	{
-		*pmin = *pmax = 0;
-		return;
-	}
-	end = start + num - 1;
-
-	startblock = start / SAMPLES_PER_BLOCK;
-	endblock = (start + num - 1) / SAMPLES_PER_BLOCK;
-
-	assert(startblock >= 0);
-	assert(endblock < numblocks);
-	assert((endblock+1)*SAMPLES_PER_BLOCK > end);
-
-	for (block = startblock; block <= endblock; block++)
-	{
-		int blkfirst, blklast;
+	truepeaksdrawn = truepeaksready();
+	render(&view);
 
-		blkfirst = block * SAMPLES_PER_BLOCK;
-		blklast = (block+1) * SAMPLES_PER_BLOCK - 1;
-		if (blklast >= numsamples)
-			blklast = numsamples - 1;
-
-		if (!(blocks[block].filledin & PEAK_FILLED_IN(odd)))
-		{
-			// Fill in the block, including the relevant samples.
+	scare_mouse();
+	vsync();
+	blit(view.buffer, screen, 0, 0, 0, 0, scrwidth, scrheight);
+	unscare_mouse();
+}
 
-			blockmin = MAXSAMP;
-			blockmax = MINSAMP;
-			if (blkfirst < start)
-			{
-				getminmax_raw_se(odd, blkfirst, start - 1,
-					&blockmin, &blockmax);
-			}
-			if (blklast > end)
-			{
-				getminmax_raw_se(odd, end + 1, blklast,
-					&tmpmin, &tmpmax);
-				blockmin = MIN(blockmin, tmpmin);
-				blockmax = MAX(blockmax, tmpmax);
-			}
-			getminmax_raw_se(odd, MAX(blkfirst, start),
-				MIN(blklast, end), &tmpmin, &tmpmax);
-			min = MIN(min, tmpmin);
-			max = MAX(max, tmpmax);
-			blockmin = MIN(blockmin, tmpmin);
-			blockmax = MAX(blockmax, tmpmax);
-
-			// Fill in the sum in the block.
-			blocks[block].min[odd] = blockmin;
-			blocks[block].max[odd] = blockmax;
-			blocks[block].filledin |= PEAK_FILLED_IN(odd);
-		}
-		else if (blkfirst >= start && blklast <= end)
-		{
-			// The block is filled in and entirely contained
-			// within the range of samples we're interested in.
-			min = MIN(min, blocks[block].min[odd]);
-			max = MAX(max, blocks[block].max[odd]);
-		}
-		else
-		{
-			// Block's filled in, but we can't use it.
-			// We're not interested in all of it.
-			getminmax_raw_se(odd, MAX(blkfirst, start),
-				MIN(blklast, end), &tmpmin, &tmpmax);
-			min = MIN(min, tmpmin);
-			max = MAX(max, tmpmax);
-		}
-	}
+/* How many presses of an arrow key it takes to move a whole screen. */
+#define SCREEN_INTERVAL 10
 
-	*pmin = min;
-	*pmax = max;
-}
+/* What getinput() saw. */
+enum { INPUT_KEY, INPUT_WHEEL, INPUT_CLICK, INPUT_REDRAW };
 
-// Calculate the sum of squares of samples and return it.
-static double calcsos(int odd, int start, int num)
+/*
+ * Wait for a key press, a turn of the mouse wheel or a left click, and
+ * return which it was. Wheel clicks come back through pwheel, positive
+ * away from the user. Also returns, with INPUT_REDRAW, when true peaks
+ * being shown have been worked out in the background.
+ */
+static int getinput(int *pval, int *pascii, int *pwheel)
 {
-	double total = 0.0;
-	int block;
-	int startblock, endblock;
-	int end;
-	double blocktotal;
-
-	if (start + num > numsamples)
-		num = numsamples - start;
-	if (num <= 0)
-		return 0.0;
-	end = start + num - 1;
-
-	startblock = start / SAMPLES_PER_BLOCK;
-	endblock = (start + num - 1) / SAMPLES_PER_BLOCK;
-
-	assert(startblock >= 0);
-	assert(endblock < numblocks);
-	assert((endblock+1)*SAMPLES_PER_BLOCK > end);
-
-	for (block = startblock; block <= endblock; block++)
+	static int lastz = 0;
+	static int lastb = 0;
+
+	*pval = *pascii = *pwheel = 0;
+	for (;;)
 	{
-		int blkfirst, blklast;
+		int pressed;
 
-		blkfirst = block * SAMPLES_PER_BLOCK;
-		blklast = (block+1) * SAMPLES_PER_BLOCK - 1;
-		if (blklast >= numsamples)
-			blklast = numsamples - 1;
+		poll_mouse();
+		pressed = mouse_b & ~lastb;
+		lastb = mouse_b;
 
-		if (!(blocks[block].filledin & SOS_FILLED_IN(odd)))
+		if (keypressed())
 		{
-			// Fill in the block, adding the relevant samples.
-
-			double common;
-
-			blocktotal = 0.0;
-			if (blkfirst < start)
-			{
-				blocktotal += calcsos_raw_se(odd, blkfirst,
-					start - 1);
-			}
-			if (blklast > end)
-			{
-				blocktotal += calcsos_raw_se(odd, end + 1,
-					blklast);
-			}
-			common = calcsos_raw_se(odd, MAX(blkfirst, start),
-				MIN(blklast, end));
-			blocktotal += common;
-			total += common;
-
-			// Fill in the sum in the block.
-			blocks[block].sumofsquares[odd] = blocktotal;
-			blocks[block].filledin |= SOS_FILLED_IN(odd);
+			const int val = readkey();
+			*pascii = val & 0xff;
+			*pval = val >> 8;
+			return INPUT_KEY;
 		}
-		else if (blkfirst >= start && blklast <= end)
+		if (mouse_z != lastz)
 		{
-			// The block is filled in and entirely contained
-			// within the range of samples we're interested in.
-			total += blocks[block].sumofsquares[odd];
-		}
-		else
-		{
-			// Block's filled in, but we can't use it.
-			// We're not interested in all of it.
-			total += calcsos_raw_se(odd, MAX(blkfirst, start),
-				MIN(blklast, end));
+			*pwheel = mouse_z - lastz;
+			lastz = mouse_z;
+			return INPUT_WHEEL;
 		}
+		if (pressed & 1)
+			return INPUT_CLICK;
+		if (view.tpdisp && truepeaksready() != truepeaksdrawn)
+			return INPUT_REDRAW;
+		_REST(12);
 	}
-
-	return total;
-}
-
-// Calculate the RMS average and return it.
-static double calcrms(int odd, int start, int num)
-{
-	return sqrt(calcsos(odd, start, num) / num);
 }
 
-// Initialize the blocks. Note we don't fill them in yet.
-static void initblocks(void)
+/* Select samples first..last-1, or nothing if that's empty. */
+static void setselection(int first, int last)
 {
-	numblocks = (numsamples + SAMPLES_PER_BLOCK - 1) / SAMPLES_PER_BLOCK;
-	blocks = xm(sizeof *blocks, numblocks);
-	memset(blocks, 0, sizeof *blocks * numblocks);
+	view.selstart = MAX(first, 0);
+	view.selend = MIN(last, view.numsamples);
+	view.hassel = view.selstart < view.selend;
 }
 
-static int lastpeaky1, lastpeaky2;
-static int lastrmsy1, lastrmsy2;
-static int chan_i;
-
-/* Draw a column of a channel of audio. */
-static void drawcolumn(int x, int top, int height, int min, int max, int rms)
+/*
+ * Select from the column where the mouse was clicked to wherever it's
+ * let go, redrawing as it moves. A click without a drag clears the
+ * selection.
+ */
+static void dragselect(void)
 {
-	int y1, y2;
-	const int lasty1 = rms ? lastrmsy1 : lastpeaky1;
-	const int lasty2 = rms ? lastrmsy2 : lastpeaky2;
-	int color;
+	const int anchor = MID(0, mouse_x, scrwidth - 1);
+	int lastx = -1;
 
-	if (!logdisp) /* Linear display. */
+	while (mouse_b & 1)
 	{
-		int scalecount;
-		int ycenter = top + height/2;
+		const int x = MID(0, mouse_x, scrwidth - 1);
 
-		for (scalecount = vzoom; scalecount > 0; scalecount--)
+		if (x != lastx)
 		{
-			min *= 2;
-			max *= 2;
+			setselection(colsample(&view, MIN(anchor, x)),
+				colsample(&view, MAX(anchor, x) + 1));
+			draw();
+			lastx = x;
 		}
-
-		y1 = ycenter - (int)(max * height/2 / SAMP_DIV_FLOAT);
-		y2 = ycenter - (int)(min * height/2 / SAMP_DIV_FLOAT);
-	}
-	else /* Logarithmic display. */
-	{
-		double maxdb, mindb;
-
-		/* Avoid negative infinity when taking logs. */
-		if (max == 0) max = 1;
-		if (min == 0) min = 1;
-
-		maxdb = 20.0 * log10((double)abs(max) / SAMP_DIV_FLOAT);
-		mindb = 20.0 * log10((double)abs(min) / SAMP_DIV_FLOAT);
-
-		// When drawing logarithmic peak graphs, don't allow
-		// asymmetry to fubar the display.
-		if (!rms)
-		{
-			if (mindb < maxdb)
-				mindb = maxdb;
-			else
-				maxdb = mindb;
-		}
-
-		/*
-		 * XXX is this clamping necessary? should it be?
-		 * Note: 96 dB is maximum dynamic range of 16-bit
-		 * samples, in theory.
-		 */
-		if (maxdb > 0.0) maxdb = 0.0;
-		if (mindb < -MAX_DB_RANGE) mindb = -MAX_DB_RANGE;
-
-		y1 = (int)(top - mindb * height / MAX_DB_RANGE);
-		y2 = (int)(top - maxdb * height / MAX_DB_RANGE);
-	}
-
-	/* Make y1 the one on top. */
-	if (y1 > y2)
-	{
-		const int tmp = y2;
-		y2 = y1;
-		y1 = tmp;
-	}
-
-	/*
-	 * Connect this line to the last line, to avoid the
-	 * "scatterplot" look when zoomed in.
-	 */
-	if (chan_i > 0)
-	{
-		if (y2 < lasty1 - 1)
-			y2 = lasty1 - 1;
-		else if (y1 > lasty2 + 1)
-			y1 = lasty2 + 1;
-	}
-
-	if (rms)
-	{
-		if (logdisp) color = CHANNEL_LOG_RMS_COLOR;
-		else color = CHANNEL_LIN_RMS_COLOR;
+		else
+			_REST(12);
+		poll_mouse();
 	}
-	else if (logdisp) color = CHANNEL_LOG_PEAK_COLOR;
-	else color = CHANNEL_LIN_PEAK_COLOR;
 
-	vline(buffer, x, y1, y2, color);
-
-	if (rms)
-	{
-		lastrmsy1 = y1;
-		lastrmsy2 = y2;
-	}
-	else
-	{
-		lastpeaky1 = y1;
-		lastpeaky2 = y2;
-	}
+	if (lastx == anchor)
+		view.hassel = false;
 }
 
 /*
- * Draw a channel of audio.
- * top = topmost pixel, height = height, left = leftmost pixel,
- * wzoom = number of samples in 1 pixel column, cols = number of columns,
- * odd = use odd (1) or even (0) samples, start = starting sample number.
+ * Change the zoom to newzoom samples per pixel (not necessarily a
+ * whole number), keeping the sample under column x where it is.
  */
-static void drawchannel(int top, int height, int left, int wzoom, int cols,
-	int odd, int start)
+static void setzoom(double newzoom, int x)
 {
-	int max, min;
-	int skiprms;
-
-	set_clip_rect(buffer, left, top, left + cols - 1, top + height - 1);
-
-	if (!(height & 1)) height--; /* force an odd height */
-
-	lastpeaky1 = lastpeaky2 = lastrmsy1 = lastrmsy2 = top + height/2;
-
-	/* If there are too few samples for each column, skip RMS. */
-	skiprms = rmsdisp ? (wzoom < RMS_MIN_SAMPLES(samprate)) : 1;
-
-	rectfill(buffer, left, top, left + cols - 1, top + height - 1,
-		CHANNEL_BG);
-
-	if (logdisp)
-	{
-		int ix;
-		for (ix = CHANNEL_LOGGUIDE_SPACING; ix < MAX_DB_RANGE;
-			ix += CHANNEL_LOGGUIDE_SPACING)
-		{
-			const int y = (int)(top + ix * height / MAX_DB_RANGE);
-			hline(buffer, left, y, left + cols - 1,
-				ix % CHANNEL_LOGGUIDE_MAJOR_SPACING == 0
-					? CHANNEL_LOGGUIDE_COLOR_MAJOR
-					: CHANNEL_LOGGUIDE_COLOR_MINOR);
-		}
-	}
-	else
-	{
-		hline(buffer, left, top + height/2, left + cols - 1,
-			CHANNEL_DCLINE_COLOR);
-	}
-
-	for (chan_i = 0; chan_i < cols; chan_i++)
-	{
-		double rmsval;
-		int rmsint;
-
-		if (peakdisp)
-		{
-			getminmax(odd, start + chan_i*wzoom, wzoom, &min, &max);
-			drawcolumn(chan_i + left, top, height, min, max, 0);
-		}
-
-		if (!skiprms)
-		{
-			rmsval = calcrms(odd, start + chan_i*wzoom, wzoom);
-			rmsint = (int)(SAMP_DIV_FLOAT * rmsval);
-			drawcolumn(chan_i + left, top, height,
-				-rmsint, rmsint, 1);
-		}
-	}
-
-	set_clip_rect(buffer, 0, 0, buffer->w, buffer->h);
+	const double anchor = view.pos + x * view.zoom;
+	const double maxzoom = (double)view.numsamples / scrwidth;
+
+	if (newzoom > maxzoom)
+		newzoom = maxzoom;
+	if (newzoom < 1.0)
+		newzoom = 1.0;
+	view.zoom = newzoom;
+	view.pos = (int)(anchor - x * view.zoom);
 }
 
-static const char *makemarker(double timepos, double interval)
+// Show or hide true peaks, starting their background pass if need be.
+static void toggletruepeak(void)
 {
-	int decimals;
-	double n;
-	static char buf[20];
-
-	/*
-	 * Count the number of decimals in this interval value:
-	 * 1.0    : 0
-	 * 0.1    : 1
-	 * 0.01   : 2
-	 * 0.001  : 3
-	 * 0.0001 : 4, etc.
-	 */
-	for (n = interval, decimals = 0; n < 1.0; n *= 10, decimals++)
-		;
+	int i;
 
-	snprintf(buf, sizeof buf, "%.*f", decimals, timepos);
-	return buf;
+	view.tpdisp = !view.tpdisp;
+	if (view.tpdisp)
+		for (i = 0; i < view.ntracks; i++)
+			track_starttruepeak(view.tracks[i]);
 }
 
-#define FONTHEIGHT 8
-#define FONTWIDTH 8
-
-static void drawtimemarkers(int top, int left, int width, int start, int num)
+/*
+ * Centre the view on the next place, in any track, where the true peak
+ * goes over full scale, after the one at the centre of the screen.
+ */
+static void nextover(void)
 {
-	double totaltime;
-	double markerinterval = 1000.0;
-	double secsperpixel;
-	double t;
-	double startsecs, endsecs; /* start and end of visible part, in secs */
-
-	totaltime = (double)num / samprate; /* time in seconds */
-	secsperpixel = totaltime / width;
-	startsecs = (double)start / samprate;
-	endsecs = (double)(start + num) / samprate;
+	const int centre = colsample(&view, scrwidth/2);
+	int i, at, next = -1;
 
-	/*
-	 * Divide markerinterval by 10 as long as there's still room
-	 * for each marker without overlapping the next, or getting too close.
-	 */
-	while ((1+strlen(makemarker(endsecs, markerinterval/10))) * FONTWIDTH
-		< markerinterval/10/secsperpixel)
+	if (!view.tpdisp)
+		toggletruepeak();
+	for (i = 0; i < view.ntracks; i++)
 	{
-		markerinterval /= 10;
+		at = track_nextover(view.tracks[i], centre);
+		if (at >= 0 && (next < 0 || at < next))
+			next = at;
 	}
-
-	/* Find the first marker interval, where it should be. */
-	t = (double)start / samprate;
-	if (fmod(t, markerinterval) > DBL_EPSILON)
-		t += markerinterval - fmod(t, markerinterval);
-	for (; t < endsecs; t += markerinterval)
+	if (next >= 0)
 	{
-		int x = (int)((t - startsecs)/secsperpixel) + left;
-		vline(buffer, x, top - FONTHEIGHT/4, top + 3*FONTHEIGHT/4,
-			MARKER_FG);
-		textout_ex(buffer, font, makemarker(t, markerinterval),
-			x + 2, top, MARKER_TEXT, -1);
+		view.pos = next + SAMPLES_PER_BLOCK/2
+			- (int)(scrwidth/2 * view.zoom);
 	}
 }
 
-static void draw(void)
-{
-	int ch;
-
-	clear_to_color(buffer, SCREEN_BG);
-
-	for (ch = 0; ch < 2; ch++)
-	{
-		drawchannel(ch * scrheight/2, scrheight/2 - FONTHEIGHT,
-			0, zoom, scrwidth, ch, pos);
-		drawtimemarkers((ch+1) * scrheight/2 - FONTHEIGHT, 0,
-			scrwidth, pos, zoom*scrwidth);
-	}
-
-	scare_mouse();
-	vsync();
-	blit(buffer, screen, 0, 0, 0, 0, scrwidth, scrheight);
-	unscare_mouse();
-}
-
-/* How many presses of an arrow key it takes to move a whole screen. */
-#define SCREEN_INTERVAL 10
-
 /* Return 1 to quit. */
 static int cycle(void)
 {
-	int keyascii, keyval;
+	int keyascii, keyval, wheel;
+	int input;
 
 	draw();
-	READKEY(keyval, keyascii);
-	if (keyval == KEY_PGUP)
-		pos -= scrwidth * zoom;
+	input = getinput(&keyval, &keyascii, &wheel);
+	if (input == INPUT_WHEEL) /* fine zoom around the mouse pointer */
+		setzoom(view.zoom * pow(ZOOM_STEP, -wheel), mouse_x);
+	else if (input == INPUT_CLICK) /* select with the mouse */
+		dragselect();
+	else if (keyval == KEY_PGUP)
+		view.pos -= (int)(scrwidth * view.zoom);
 	else if (keyval == KEY_PGDN)
-		pos += scrwidth * zoom;
+		view.pos += (int)(scrwidth * view.zoom);
 	else if (keyval == KEY_LEFT)
-		pos -= scrwidth * zoom / SCREEN_INTERVAL;
+		view.pos -= (int)(scrwidth * view.zoom / SCREEN_INTERVAL);
 	else if (keyval == KEY_RIGHT)
-		pos += scrwidth * zoom / SCREEN_INTERVAL;
+		view.pos += (int)(scrwidth * view.zoom / SCREEN_INTERVAL);
 	else if (keyval == KEY_HOME)
-		pos = 0;
+		view.pos = 0;
 	else if (keyval == KEY_END)
-		pos = numsamples - scrwidth*zoom;
+		view.pos = view.numsamples - (int)(scrwidth * view.zoom);
 	else if (keyval == KEY_UP) /* zoom in */
-	{
-		pos += scrwidth*zoom/2;
-		zoom /= 2;
-		if (zoom < 1)
-			zoom = 1;
-		pos -= scrwidth*zoom/2;
-	}
+		setzoom(view.zoom / 2, scrwidth/2);
 	else if (keyval == KEY_DOWN) /* zoom out */
-	{
-		pos += scrwidth*zoom/2;
-		zoom *= 2;
-		if (zoom > numsamples/scrwidth)
-			zoom = numsamples/scrwidth;
-		pos -= scrwidth*zoom/2;
-	}
+		setzoom(view.zoom * 2, scrwidth/2);
+	else if (keyascii == '+' || keyascii == '=') /* fine zoom in */
+		setzoom(view.zoom / ZOOM_STEP, scrwidth/2);
+	else if (keyascii == '-') /* fine zoom out */
+		setzoom(view.zoom * ZOOM_STEP, scrwidth/2);
 	else if (keyval == KEY_F3) /* vertical zoom out */
 	{
-		if (vzoom > VZOOM_MIN)
-			vzoom--;
+		if (view.vzoom > VZOOM_MIN)
+			view.vzoom--;
 	}
 	else if (keyval == KEY_F4) /* vertical zoom in */
 	{
-		if (vzoom < VZOOM_MAX)
-			vzoom++;
+		if (view.vzoom < VZOOM_MAX)
+			view.vzoom++;
 	}
 	else if (tolower(keyascii) == 'l') /* toggle log view */
-		logdisp = !logdisp;
+		view.logdisp = !view.logdisp;
 	else if (tolower(keyascii) == 'p') /* peak display */
-		peakdisp = !peakdisp;
+		view.peakdisp = !view.peakdisp;
 	else if (tolower(keyascii) == 'r') /* rms display */
-		rmsdisp = !rmsdisp;
+		view.rmsdisp = !view.rmsdisp;
+	else if (tolower(keyascii) == 'm') /* mid/side display */
+		view.msdisp = !view.msdisp;
+	else if (tolower(keyascii) == 'c') /* correlation display */
+		view.corrdisp = !view.corrdisp;
+	else if (tolower(keyascii) == 't') /* true peak display */
+		toggletruepeak();
+	else if (tolower(keyascii) == 'o') /* next true peak over */
+		nextover();
+	else if (tolower(keyascii) == 'h') /* level histogram, cycling */
+		view.histdisp = (view.histdisp + 1) % (HIST_WHOLE + 1);
+	else if (tolower(keyascii) == 'v') /* select what's visible */
+		setselection(view.pos, colsample(&view, scrwidth));
+	else if (tolower(keyascii) == 'a') /* select everything */
+		setselection(0, view.numsamples);
+	else if (tolower(keyascii) == 'x') /* clear selection */
+		view.hassel = false;
 	else if (keyval == KEY_ESC) /* quit */
 		return 1;
 
-	if (pos > numsamples - scrwidth*zoom)
-		pos = numsamples - scrwidth*zoom;
-	if (pos < 0)
-		pos = 0;
+	if (view.pos > view.numsamples - (int)(scrwidth * view.zoom))
+		view.pos = view.numsamples - (int)(scrwidth * view.zoom);
+	if (view.pos < 0)
+		view.pos = 0;
 
 	return 0;
 }
 
-static void initfromwav(char *data, uint32_t datalen) {
-	uint16_t channels;
-	uint16_t formattag;
-	uint16_t bitdepth;
-	uint32_t fmtchunklen;
-	uint32_t offset;
-	uint32_t chunklen;
-	uint32_t wavsamplerate;
-	int i;
+/*
+ * Offscreen rendering, for checking that changes to the drawing and
+ * summary code don't change any pixels, or slow anything down.
+ */
 
-	/*
-	 * TODO: support wav files with lengths (of both file and data chunk)
-	 * given as 0xFFFFFFFF by simply reading until end of file.
-	 * This is what madplay produces on stdout.
-	 */
-	if (datalen < 44 || memcmp(data, "RIFF", 4) ||
-		memcmp(&data[8], "WAVEfmt ", 8) ||
-		le32toh(*(uint32_t *)&data[4]) + 8 != datalen) {
-		errquit("invalid .wav file");
+/* A render may take this much longer than its recorded time. */
+#define RENDER_MARGIN 1.5
+#define RENDER_SLACK_MS 1.0
+#define RENDER_REPEAT 5 /* Renders per combination; the fastest counts. */
+
+/* Zooms to try. 0 means the whole of the longest track. */
+static const double benchzooms[] = { 1.0, 3.7, 16.0, 100.5, 1024.0, 0.0 };
+
+/*
+ * Hash the pixels of the buffer as 0xRRGGBB (32-bit FNV-1a), on from
+ * the hash of the text drawn.
+ */
+static uint32_t hashbuffer(uint32_t hash)
+{
+	int x, y, c;
+
+	for (y = 0; y < view.buffer->h; y++)
+	{
+		for (x = 0; x < view.buffer->w; x++)
+		{
+			c = getpixel(view.buffer, x, y);
+			hash ^= (uint32_t)getr(c) << 16 | getg(c) << 8 | getb(c);
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+static double nowms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Render every combination of zoom, vertical zoom, log/linear display,
+ * peak/RMS traces, plain/mid-side-and-correlation view and extras (the
+ * true peak trace, and the level histogram with a selection and its
+ * statistics), at the start and the middle of the longest track.
+ * Prints a line per combination naming it, with the hash of its pixels
+ * and its best time. Text is hashed as strings, and pixels as RGB, so
+ * hashes don't depend on Allegro's font or the color depth.
+ *
+ * If baseline is not NULL, it's the output of an earlier run to check
+ * against: a different hash, or a time more than the margin over the
+ * recorded one, is a failure. A baseline line may leave out the time,
+ * to check the hash alone. Returns the number of failures.
+ */
+static int renderbench(FILE *baseline)
+{
+	char (*lines)[160] = NULL;
+	int nlines = 0, slines = 0;
+	char line[160];
+	int failures = 0;
+	int iz, combo, i, recorded;
+
+	while (baseline != NULL && fgets(line, sizeof line, baseline))
+	{
+		XPND(lines, nlines, slines);
+		strcpy(lines[nlines++], line);
 	}
-	fmtchunklen = le32toh(*(uint32_t *)&data[16]);
-	formattag = le16toh(*(uint16_t *)&data[20]);
-	channels = le16toh(*(uint16_t *)&data[22]);
-	wavsamplerate = le32toh(*(uint32_t *)&data[24]);
-	bitdepth = le16toh(*(uint16_t *)&data[34]);
-	if (formattag == 0xFFFE)
-		formattag = le16toh(*(uint16_t *)&data[44]);
-	if (formattag != 0x0001)
-		errquit("non-PCM wav data: format tag %u", formattag);
-	if (wavsamplerate > 384000)
-		errquit("unsupported sample rate %u", wavsamplerate);
-	samprate = (int)wavsamplerate;
-	if (channels != 2)
-		errquit("non-stereo wav files not supported");
-
-	/* Find data chunk */
-	offset = 16 + 4 + fmtchunklen;
-	while (1) {
-		if (offset + 8 > datalen)
-			errquit("wav has no data chunk");
-
-		chunklen = le32toh(*(uint32_t *)&data[offset + 4]);
-		if (memcmp(&data[offset], "data", 4) == 0) break;
-		offset += chunklen;
+
+	// The true peaks are worked out in the background; wait for them.
+	for (i = 0; i < view.ntracks; i++)
+	{
+		track_starttruepeak(view.tracks[i]);
+		while (!track_truepeakready(view.tracks[i]))
+			_REST(1);
 	}
-	offset += 8; /* Skip data chunk ID and len */
-	if (offset + chunklen != datalen)
-		errquit("invalid .wav file: data chunk wrong size");
-	numsamples = chunklen / channels / (bitdepth / 8);
-	if (bitdepth == 16) {
-		samples = (int16_t *)&data[offset];
-		for (i = 0; i < numsamples; i++)
-			samples[i] = le16toh(samples[i]);
-	} else if (bitdepth == 24) {
-		samples = xm(2, numsamples * channels);
-		for (i = 0; i < numsamples * channels; i++) {
-			samples[i] = (int16_t)data[offset + i*3 + 1]
-				+ ((int16_t)data[offset + i*3 + 2]<<8);
+
+	for (iz = 0; iz < (int)(sizeof benchzooms / sizeof benchzooms[0]);
+		iz++)
+	{
+		for (combo = 0; combo < 2*2*3*2*2*2*2; combo++)
+		{
+			char key[128];
+			double best = 0.0, recordedms;
+			unsigned recordedhash;
+			uint32_t hash = 0;
+			int span;
+
+			view.zoom = benchzooms[iz] > 0.0 ? benchzooms[iz]
+				: MAX((double)view.numsamples / scrwidth, 1.0);
+			view.vzoom = combo % 2 * 4;
+			view.logdisp = combo / 2 % 2;
+			view.peakdisp = combo / 4 % 3 != 1;
+			view.rmsdisp = combo / 4 % 3 != 0;
+			view.msdisp = view.corrdisp = combo / 12 % 2;
+			view.pos = combo / 24 % 2 * (view.numsamples
+				- (int)(scrwidth * view.zoom)) / 2;
+			if (view.pos < 0)
+				view.pos = 0;
+
+			// The middle third of the screen is selected.
+			view.tpdisp = combo / 48 % 2;
+			view.hassel = combo / 96 % 2;
+			view.histdisp = !view.hassel ? HIST_OFF
+				: view.tpdisp ? HIST_WHOLE : HIST_VISIBLE;
+			span = (int)MIN(scrwidth * view.zoom, view.numsamples);
+			view.selstart = view.pos + span / 3;
+			view.selend = view.pos + span - span / 3;
+
+			for (i = 0; i < RENDER_REPEAT; i++)
+			{
+				const double start = nowms();
+				double ms;
+
+				hash = 2166136261u;
+				view.texthash = &hash;
+				render(&view);
+				ms = nowms() - start;
+				if (i == 0 || ms < best)
+					best = ms;
+			}
+			view.texthash = NULL;
+			hash = hashbuffer(hash);
+
+			snprintf(key, sizeof key,
+				"zoom=%.1f vzoom=%d log=%d peak=%d rms=%d"
+				" midside=%d pos=%d tp=%d hist=%d sel=%d",
+				view.zoom, view.vzoom, view.logdisp,
+				view.peakdisp, view.rmsdisp, view.msdisp,
+				view.pos, view.tpdisp, view.histdisp,
+				view.hassel);
+			printf("%s hash=%08lx time=%.3f\n", key,
+				(unsigned long)hash, best);
+
+			if (baseline == NULL)
+				continue;
+			for (i = 0; i < nlines; i++)
+			{
+				if (strncmp(lines[i], key, strlen(key)) == 0
+					&& lines[i][strlen(key)] == ' ')
+				{
+					break;
+				}
+			}
+			recorded = i == nlines ? 0 : sscanf(lines[i]
+				+ strlen(key), " hash=%x time=%lf",
+				&recordedhash, &recordedms);
+			if (recorded < 1)
+			{
+				fprintf(stderr, "FAIL %s: no baseline\n", key);
+				failures++;
+			}
+			else if (recordedhash != hash)
+			{
+				fprintf(stderr, "FAIL %s: hash %08lx, was %08x\n",
+					key, (unsigned long)hash, recordedhash);
+				failures++;
+			}
+			else if (recorded == 2 && best
+				> recordedms * RENDER_MARGIN + RENDER_SLACK_MS)
+			{
+				fprintf(stderr, "FAIL %s: %.3f ms, was %.3f ms\n",
+					key, best, recordedms);
+				failures++;
+			}
 		}
-	} else errquit("unsupported bit depth: %u", bitdepth);
+	}
+
+	free(lines);
+	return failures;
 }
 
 static void usage(void)
 {
-	errquit("usage: viewwav [-width X] [-height Y] [-forceraw] filename");
+	errquit("usage: viewwav [-width X] [-height Y] [-forceraw] [-pack] "
+		"[-mem MB] [-renderhash | -rendercheck baseline] filename...\n"
+		"       viewwav [-forceraw] [-pack] [-mem MB] -serve socket");
 }
 
 int main(int argc, char *argv[])
 {
-	char *data;
-	char *filename;
-	uint32_t datalen;
-	FILE *fp;
+	FILE **fps;
+	BITMAP *buffer;
+	track_t **tracks;
+	int ntracks;
+	FILE *baseline = NULL;
 	const char *str;
-	bool iswav;
 	bool forceraw = false;
+	bool pack = false;
+	bool renderonly = false;
+	bool usedstdin = false;
+	const char *sockpath = NULL;
+	int memmb = 0;
 	int i;
 
 	// Default sample rate based on environment variable.
@@ -772,16 +496,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "cannot initialize Allegro\n");
 		exit(EXIT_FAILURE);
 	}
-	if (install_keyboard() != 0)
-		errquit("can't install keyboard handler: %s", allegro_error);
-	if (install_timer() != 0)
-		errquit("can't install timers: %s", allegro_error);
 
 	if (argc < 2)
 		usage();
 	argc--, argv++;
 
-	while (argc > 1)
+	while (argc > 1 && argv[0][0] == '-' && argv[0][1] != '\0')
 	{
 		if (!strcmp("-width", *argv) && argc > 2)
 		{
@@ -800,58 +520,121 @@ int main(int argc, char *argv[])
 			forceraw = true;
 			argc--, argv++;
 		}
+		else if (!strcmp("-pack", *argv))
+		{
+			pack = true;
+			argc--, argv++;
+		}
+		else if (!strcmp("-renderhash", *argv))
+		{
+			renderonly = true;
+			argc--, argv++;
+		}
+		else if (!strcmp("-rendercheck", *argv) && argc > 2)
+		{
+			renderonly = true;
+			if ((baseline = fopen(argv[1], "r")) == NULL)
+				errquit("cannot open %s", argv[1]);
+			argc -= 2, argv += 2;
+		}
+		else if (!strcmp("-mem", *argv) && argc > 2)
+		{
+			memmb = atoi(argv[1]);
+			if (memmb <= 0) errquit("bad memory budget");
+			argc -= 2, argv += 2;
+		}
+		else if (!strcmp("-serve", *argv))
+		{
+			sockpath = argv[1];
+			argc -= 2, argv += 2;
+		}
 		else usage();
 	}
 
-	filename = *argv;
-	if (strcmp("-", filename) == 0)
-	{
-		fp = stdin;
-		SET_BINARY_MODE
+	/*
+	 * The tile server keeps files loaded within the budget, evicting
+	 * what it hasn't used lately; it doesn't bomb out at the limit.
+	 */
+	if (sockpath != NULL)
+	{
+		if (argc != 0)
+			usage();
+		track_startworkers();
+		serve(sockpath, (size_t)(memmb > 0 ? memmb : DEF_SERVE_MEM)
+			<< 20, forceraw, pack, samprate);
+	}
+	if (memmb > 0)
+		track_setmembudget((size_t)memmb << 20);
+
+	/* Every file gets its own lane, stacked top to bottom. */
+	ntracks = argc;
+	if (scrheight / ntracks < 4 * FONTHEIGHT)
+		errquit("too many files for a window %d pixels high", scrheight);
+	fps = xm(sizeof *fps, ntracks);
+	for (i = 0; i < ntracks; i++)
+	{
+		if (issynth(argv[i]))
+			fps[i] = NULL;
+		else if (strcmp("-", argv[i]) == 0)
+		{
+			if (usedstdin) errquit("can only read stdin once");
+			usedstdin = true;
+			fps[i] = stdin;
+			SET_BINARY_MODE
+		}
+		else if ((fps[i] = fopen(argv[i], "rb")) == NULL)
+			errquit("cannot open %s", argv[i]);
 	}
-	else if ((fp = fopen(filename, "rb")) == NULL)
-		errquit("cannot open %s", filename);
 
-	if (set_gfx_mode(GFX_AUTODETECT_WINDOWED, scrwidth, scrheight, 0, 0)
-		!= 0)
+	if (!renderonly)
 	{
-		errquit("can't set graphics mode: %s", allegro_error);
+		if (install_keyboard() != 0)
+		{
+			errquit("can't install keyboard handler: %s",
+				allegro_error);
+		}
+		if (install_timer() != 0)
+			errquit("can't install timers: %s", allegro_error);
+		install_mouse(); /* Optional; used for the wheel. */
+
+		if (set_gfx_mode(GFX_AUTODETECT_WINDOWED, scrwidth, scrheight,
+			0, 0) != 0)
+		{
+			errquit("can't set graphics mode: %s", allegro_error);
+		}
 	}
+	// Offscreen, draw in true color, so hashes don't hang on a palette.
+	if (renderonly)
+		set_color_depth(32);
 	buffer = create_bitmap(scrwidth, scrheight);
 	if (buffer == NULL)
 		errquit("can't create buffer: %s", allegro_error);
-	show_mouse(screen);
-
-	data = readfile(fp, &datalen);
-	if (fp != stdin)
-		fclose(fp);
+	if (!renderonly)
+		show_mouse(screen);
 
-	/* Is it a wav file? On stdin, sniff; from file, check extension. */
-	if (!forceraw && fp == stdin && datalen > 1000 &&
-		memcmp(data, "RIFF", 4) == 0 &&
-		memcmp((data + 8), "WAVEfmt ", 8) == 0)
+	track_startworkers();
+	tracks = xm(sizeof *tracks, ntracks);
+	for (i = 0; i < ntracks; i++)
 	{
-		iswav = true;
-	}
-	else if (!forceraw && strlen(filename) > 4 && datalen > 1000 &&
-		strcasecmp(&filename[strlen(filename) - 4], ".wav") == 0)
-	{
-		iswav = true;
+		if (fps[i] == NULL)
+			tracks[i] = synth(argv[i], samprate);
+		else
+		{
+			tracks[i] = loadtrack(argv[i], fps[i], forceraw,
+				samprate);
+		}
+		if (pack)
+			track_pack(tracks[i]);
 	}
-	else iswav = false;
+	free(fps);
+	view_init(&view, buffer, tracks, ntracks);
+	view.parallel = true;
 
-	if (iswav)
-	{
-		initfromwav(data, datalen);
-	}
-	else
-	{
-		samples = (int16_t *)data;
-		numsamples = datalen / (2 * sizeof (int16_t));
-		for (i = 0; i < numsamples; i++)
-			samples[i] = le16toh(samples[i]);
-	}
-	initblocks();
+	if (renderonly)
+		return renderbench(baseline) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	// Not for the benchmark, whose repeats would all come from cache.
+	view_cachecolumns(&view);
 	while (!cycle())
 		;
 	return 0;